@@ -14,7 +14,7 @@ SERVER_PORT = 20000
 PROJECT_DIR = '~/ringding/'
 CLEAN_BUILD = False
 DEBUG = False
-BIN = 'buffer_mgr'
+BIN = 'buffer_mgr'  # buffer_mgr_16k, buffer_mgr_64k for larger pages
 
 
 server_list = ServerList(
@@ -0,0 +1,95 @@
+#include "kuring.hpp"
+#include "utils/cli_parser.hpp"
+#include "utils/cpu_map.hpp"
+#include "utils/literals.hpp"
+#include "utils/my_logger.hpp"
+#include "utils/rdtsc_clock.hpp"
+
+#include <fstream>
+#include <liburing.h>
+#include <unistd.h>
+#include <vector>
+
+// Switch cost and memory per fiber of the reactor runtime: every fiber yields
+// `yields` times, one yield is two context switches (fiber -> reactor -> next).
+
+thread_local u64 write_cycles = 0;
+thread_local RDTSCClock write_clock(2.4_GHz);
+thread_local u64 io_cycles = 0;
+
+
+struct BenchConfig {
+    std::vector<uint64_t> fibers = {1'000, 4'000, 16'000};
+    uint64_t yields = 1'000;
+    uint64_t fiber_stack = 128_KiB;
+    int core_id = 3;
+
+    void parse(int argc, char** argv) {
+        cli::Parser parser(argc, argv);
+        parser.parse("--fibers", fibers, cli::Parser::optional);
+        parser.parse("--yields", yields, cli::Parser::optional);
+        parser.parse("--fiber_stack", fiber_stack, cli::Parser::optional);
+        parser.parse("--core_id", core_id, cli::Parser::optional);
+        parser.check_unparsed();
+        parser.print();
+    }
+};
+
+
+// resident set in bytes, huge pages are not part of it
+static uint64_t rss() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size, resident;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+int main(int argc, char** argv) {
+    BenchConfig cfg;
+    cfg.parse(argc, argv);
+
+    if (cfg.core_id != -1) {
+        CPUMap::get().pin(cfg.core_id);
+    }
+
+    for (uint64_t n : cfg.fibers) {
+        struct io_uring ring = {}; // never used, fibers only yield
+        Reactor r(ring);
+        r.stacks.stack_size = cfg.fiber_stack;
+        mini::set_reactor(r);
+
+        uint64_t rss_before = rss();
+        bool stop = false;
+        uint64_t done = 0;
+        std::vector<mini::Fiber> fibers;
+        fibers.reserve(n);
+        for (uint64_t i = 0; i < n; ++i) {
+            fibers.emplace_back([&] {
+                for (uint64_t k = 0; k < cfg.yields; ++k) {
+                    mini::yield();
+                }
+                if (++done == n) {
+                    stop = true;
+                }
+            });
+        }
+
+        RDTSCClock clock(2.4_GHz);
+        clock.start();
+        r.run(stop);
+        clock.stop();
+        uint64_t rss_after = rss();
+
+        double ns_per_yield = clock.as<std::chrono::nanoseconds, double>() / (n * cfg.yields);
+        Logger::info("fibers=", n,
+                     " ns/yield=", ns_per_yield,
+                     " cycles/yield=", clock.cycles() / static_cast<double>(n * cfg.yields),
+                     " stack_bytes/fiber=", r.stacks.reserved / static_cast<double>(n),
+                     " rss_bytes/fiber=", (rss_after - rss_before) / static_cast<double>(n),
+                     " control_block=", sizeof(Reactor::Fiber));
+
+        fibers.clear();
+    }
+    return 0;
+}
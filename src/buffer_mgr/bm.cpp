@@ -9,12 +9,15 @@
 #include "utils/my_logger.hpp"
 #include "utils/nvme.hpp"
 #include "utils/rdtsc_clock.hpp"
+#include "wal.hpp"
 
 #include <boost/fiber/operations.hpp>
 #include <chrono>
 #include <fcntl.h>
 #include <libaio.h>
 #include <liburing.h>
+#include <numa.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -24,10 +27,15 @@ uint32_t lba_shift;
 
 BufferManager::BufferManager() {}
 
-void BufferManager::init() {
+void BufferManager::init(unsigned shard) {
     cfg = Config::get();
+    shard_id = shard;
+    if (peers.empty()) {
+        peers.resize(cfg.shards);
+    }
+    peers.at(shard_id) = this;
 
-    page_count = cfg.virt_size / pageSize; // physical slots we can keep in memory
+    page_count = cfg.virt_size / pageSize / cfg.shards; // physical slots we can keep in memory
 
     toEvict.reserve(cfg.evict_batch);
     toWrite.reserve(cfg.evict_batch);
@@ -36,42 +44,60 @@ void BufferManager::init() {
         return 1 << (64 - __builtin_clzl(x - 1));
     };
 
+    if (cfg.numa) {
+        // the shard thread is pinned already, bind its partition to that node
+        numa_node = numa_node_of_cpu(sched_getcpu());
+        check_ret(numa_node);
+        Logger::info("shard=", shard_id, " numa_node=", numa_node);
+    }
+
     uint64_t page_table_sz = next_pow2(page_count * cfg.page_table_factor);
     Logger::info("page_count=", page_count, " page_table_sz=", page_table_sz,
                  " ratio=", page_table_sz / static_cast<double>(page_count));
-    page_table = std::make_unique<PageTable>(page_table_sz);
+    page_table = std::make_unique<PageTable>(page_table_sz, numa_node);
 
-    buffer_frames = HugePages::malloc_array<BufferFrame>(page_count);
-    pages = HugePages::malloc_array<Page>(page_count);
+    buffer_frames = HugePages::malloc_array_on_socket<BufferFrame>(page_count, numa_node);
+    pages = HugePages::malloc_array_on_socket<Page>(page_count, numa_node);
+    policy = makeEvictionPolicy(cfg.eviction, *this);
 
     int open_flags = O_DIRECT | O_RDWR;
     if (cfg.nvme_cmds) {
         open_flags &= ~O_DIRECT;
+    }
 
-        int fd = open(cfg.ssd.c_str(), open_flags);
+    devices.clear();
+    for (auto& path : cfg.ssds) {
+        if constexpr (mini::SIM) {
+            // the reactor keeps one DRAM disk per fd, nothing is opened
+            int fd = devices.size();
+            devices.push_back({.fd = fd, .sqe_fd = fd});
+            continue;
+        }
+        int fd = open(path.c_str(), open_flags, 0);
         check_ret(fd);
-        nvme_get_info(fd);
-        close(fd);
+        if (cfg.nvme_cmds) {
+            // passthrough commands carry nsid and lba_shift of the first device
+            uint32_t first_nsid = nsid;
+            uint32_t first_lba_shift = lba_shift;
+            nvme_get_info(fd);
+            if (!devices.empty()) {
+                ensure(nsid == first_nsid && lba_shift == first_lba_shift, "striped devices must be formatted alike");
+            }
+        }
+        devices.push_back({.fd = fd, .sqe_fd = fd});
     }
 
-    const char* path = cfg.ssd.c_str();
-    blockfd = open(path, open_flags, 0);
-    check_ret(blockfd);
-
-    freeList.reserve(page_count);
-    // push free physical slots in descending order so pop_back gives 1,2,...
-    for (u64 i = 0; i < page_count; ++i) {
-        BID bid = page_count - i - 1;
-        if (bid == 0) {
-            break; // metadata page
-        }
-        ensure(isValidPtr(pages + bid));
-        freeList.push_back(bid);
+    // every physical slot but the metadata page, handed out as 1,2,...
+    freeFrames.init(page_count, cfg.evict_batch, cfg.free_target, cfg.free_high);
+    if (cfg.coroutines) {
+        freeFrames.wake_evictor = [this] { eviction_task.wakeup(); };
+    } else {
+        freeFrames.wake_evictor = [this] { eviction_fiber.wakeup(); };
     }
 
     // allocate and map metadata page 0 to physical 0
     BufTagged buf(0);
-    buf.set_dirty(true);
+    markDirty(&buf);
     buf.set_marked(true);
     bool inserted = page_table->insert(0, buf);
     ensure(inserted);
@@ -79,6 +105,13 @@ void BufferManager::init() {
     auto& frame = buffer_frames[buf.id()];
     new (&frame) BufferFrame(0);
 
+    if (shard_id != 0) {
+        // trees are created on shard 0 before the other shards start
+        auto* primary = peers.at(0);
+        std::memcpy(pages + buf.id(), primary->pages + primary->page_table->find(0)->id(), pageSize);
+        rootHeight = primary->rootHeight;
+    }
+
     // setup uring
     struct io_uring_params params;
     memset(&params, 0, sizeof(params));
@@ -92,7 +125,7 @@ void BufferManager::init() {
         params.flags |= IORING_SETUP_SQPOLL;
         params.sq_thread_idle = 1000;
         if (cfg.core_id != -1) {
-            params.sq_thread_cpu = cfg.core_id + 1;
+            params.sq_thread_cpu = cfg.core_id + cfg.shards + shard_id;
             params.flags |= IORING_SETUP_SQ_AFF;
         }
     }
@@ -115,11 +148,12 @@ void BufferManager::init() {
         ensure(io_uring_register_ring_fd(&ring) == 1);
     }
 
-    ssd_fd = blockfd;
     if (cfg.reg_fds) {
         check_iou(io_uring_register_files_sparse(&ring, 1024));
-        check_iou(io_uring_register_files_update(&ring, /*off*/ 0, &ssd_fd, 1));
-        ssd_fd = 0;
+        for (unsigned i = 0; i < devices.size(); ++i) {
+            check_iou(io_uring_register_files_update(&ring, /*off*/ i, &devices[i].fd, 1));
+            devices[i].sqe_fd = i;
+        }
     }
 
     if (cfg.reg_bufs) {
@@ -136,57 +170,129 @@ void BufferManager::init() {
         check_iou(io_uring_register_buffers(&ring, iov.data(), iov.size()));
     }
 
+    if (!cfg.wal.empty()) {
+        wal.init(shard_id, /*reg_slot*/ devices.size());
+    }
+
 
     r = std::make_unique<Reactor>(ring);
+    r->stacks.stack_size = cfg.fiber_stack;
     mini::set_reactor(*r);
     r->total_io_fibers = cfg.concurrency;
+    r->batcher.init(cfg.concurrency);
+    if (cfg.steal) {
+        r->init_stealing(cfg.concurrency * cfg.shards); // all workers may end up here
+    }
+#ifdef BM_SIM
+    r->disk_size = cfg.sim_disk_size; // the WAL sizes its own disk
+    r->set_latency(cfg.sim_latency == "exp"       ? SimReactor::Latency::Exp
+                   : cfg.sim_latency == "uniform" ? SimReactor::Latency::Uniform
+                                                  : SimReactor::Latency::Fixed,
+                   cfg.sim_read_us, cfg.sim_write_us);
+#endif
+
+    if (cfg.shards > 1) {
+        r->on_msg = [](uint64_t data, int res) { bm.handleMessage(data, res); };
+
+        for (int i = 0; i < cfg.remote_fibers; ++i) {
+            auto& f = remote_fibers.emplace_back(std::make_unique<SleepingFiber>());
+            f->spawn(
+                [] {},
+                [] {
+                    if (bm.remoteQueue.empty()) {
+                        return true; // park
+                    }
+                    auto* req = bm.remoteQueue.back();
+                    bm.remoteQueue.pop_back();
+                    bm.serveRemote(*req);
+                    return false; // no park
+                });
+        }
+    }
 
-    // non-main function
-    eviction_fiber.spawn(
-        [&] {
-            bm.my_id.reset(new uint64_t{0xfe}); // special id for evictor
-        },
-        [&] {
-            if (bm.freeList.size() <= bm.page_count * bm.cfg.free_target) {
-                bm.evict();
+    for (int i = 0; i < cfg.scan_readahead; ++i) {
+        auto& f = prefetch_fibers.emplace_back(std::make_unique<SleepingFiber>());
+        f->spawn(
+            [] {},
+            [] {
+                if (bm.prefetchQueue.empty()) {
+                    return true; // park
+                }
+                PID pid = bm.prefetchQueue.back();
+                bm.prefetchQueue.pop_back();
+                // queued twice or faulted in by a scan in the meantime
+                if (bm.page_table->find(pid)) {
+                    return false; // no park
+                }
+                bm.handleFault(pid, true);
                 return false; // no park
+            });
+    }
+
+    // non-main function
+    if (cfg.coroutines) {
+        eviction_task.spawn([]() -> mini::co::Task<bool> {
+            if (bm.freeFrames.needsEviction()) {
+                co_await bm.evictCo();
+                co_return false; // no park
             }
-            return true; // park
+            co_return true; // park
         });
+    } else {
+        eviction_fiber.spawn(
+            [&] {
+                bm.my_id.reset(new uint64_t{0xfe}); // special id for evictor
+            },
+            [&] {
+                if (bm.freeFrames.needsEviction()) {
+                    bm.evict();
+                    return false; // no park
+                }
+                return true; // park
+            });
+    }
+
+    if (cfg.dirty_target < 1) {
+        cleaner_fiber.spawn(
+            [&] {
+                bm.my_id.reset(new uint64_t{0xfd}); // special id for cleaner
+            },
+            [&] {
+                if (bm.needsCleaning() && bm.clean()) {
+                    return false; // no park
+                }
+                return true; // park
+            });
+    }
 }
 
-void BufferManager::ensureFreePages() {
-    if (freeList.size() <= page_count * cfg.free_target) {
-        eviction_fiber.wakeup();
+void BufferManager::ensureCleanPages() {
+    if (cfg.dirty_target < 1 && !cleanStalled && needsCleaning()) {
+        cleaner_fiber.wakeup();
     }
 }
 
 // allocated new page and fix it
-Page* BufferManager::allocPage() {
-    ensureFreePages(); // we cannot do this to avoid rescheduling/locks
-
-    if (freeList.empty()) {
-        // if (freeList.size() <= page_count * 0.01) {
+Page* BufferManager::allocPage(PID& pidOut) {
+    // acquire a free physical slot, wakes the evictor below the low watermark
+    BID bid;
+    if (!freeFrames.alloc(bid)) {
         ++restarts;
         restart_ctx = AllocException{};
         return nullptr;
     }
-
-    // acquire a free physical slot
-    ensure(!freeList.empty());
-    BID bid = freeList.back();
-    freeList.pop_back();
     physUsedCount++;
 
-    // assign a new logical PID
-    PID pid = allocCount++;
+    // assign a new logical PID, owned by this shard
+    PID pid = allocCount++ * cfg.shards + shard_id;
+    pidOut = pid;
     if (do_log)
         Logger::info("fiber=", *my_id, " alloc pid=", pid, " bid=", bid);
 
     BufTagged buf(bid);
-    buf.set_dirty(true);
+    markDirty(&buf);
     buf.set_in_use(true);
-    buf.set_marked(true);
+    buf.set_marked(policy->markOnAdmit);
 
     try {
         bool inserted = page_table->insert(pid, buf);
@@ -200,29 +306,25 @@ Page* BufferManager::allocPage() {
     std::memset(page, 0, pageSize);
 
     auto& frame = buffer_frames[bid];
-    new (&frame) BufferFrame(pid);
+    frame.reuse(pid);
+    policy->admit(bid, pid);
 
     ensure(isValidPtr(page));
     return page;
 }
 
-void BufferManager::handleFault(PID pid) {
-    ensureFreePages();
-
-
-    if (freeList.empty()) {
+// takes a frame and publishes the page io-locked, false if no frame is free.
+// Read-ahead marks the page before it is published, so the first fix counts as a hit.
+bool BufferManager::startFault(PID pid, Fault& f, bool prefetch) {
+    BID bid;
+    if (!freeFrames.alloc(bid)) {
         static int to_print = 10;
         if (to_print != 0) {
             Logger::info("evictor too slow");
             --to_print;
         }
-        mini::yield();
-        return;
+        return false;
     }
-
-    ensure(!freeList.empty());
-    BID bid = freeList.back();
-    freeList.pop_back();
     physUsedCount++;
 
     if (do_log)
@@ -230,42 +332,92 @@ void BufferManager::handleFault(PID pid) {
 
     BufTagged buf(bid);
     buf.set_io_lock(true);
-    buf.set_marked(true);
+    if (policy->markOnAdmit) {
+        buf.set_marked(true);
+    } else {
+        buf.set_fresh(true);
+    }
+    if (prefetch) {
+        buf.set_prefetched(true);
+        ++readaheadIssued;
+    }
     bool inserted = page_table->insert(pid, buf);
     ensure(inserted);
     // Logger::info("fiber=", *my_id, " inserted pid=", pid);
 
     auto& frame = buffer_frames[bid];
-    new (&frame) BufferFrame(pid);
+    frame.reuse(pid);
+    policy->admit(bid, pid);
 
-    auto* page = pages + bid;
+    auto [dev, offset] = locate(pid);
+    dev->inflight++;
+    dev->ios++;
 
-    auto prep_sqe = [&](struct io_uring_sqe* sqe) {
-        auto offset = pid * pageSize;
+    f = {.pid = pid, .bid = bid, .dev = dev, .offset = offset};
+    return true;
+}
 
-        // Logger::info("read pid=", pid, " offset=", offset);
-        if (cfg.nvme_cmds) {
-            prep_nvme_read(sqe, ssd_fd, page, pageSize, offset);
-            if (cfg.reg_bufs) {
-                int buf_idx = (bid * pageSize) / REG_BUF_SIZE;
-                sqe->uring_cmd_flags |= IORING_URING_CMD_FIXED;
-                sqe->buf_index = buf_idx;
-            }
-        } else if (!cfg.reg_bufs) {
-            io_uring_prep_read(sqe, ssd_fd, page, pageSize, offset);
-        } else {
-            int buf_idx = (bid * pageSize) / REG_BUF_SIZE;
-            io_uring_prep_read_fixed(sqe, ssd_fd, page, pageSize, offset, buf_idx);
+void BufferManager::prepRead(const Fault& f, struct io_uring_sqe* sqe) {
+    auto* page = pages + f.bid;
+    auto* dev = f.dev;
+    // Logger::info("read pid=", f.pid, " offset=", f.offset);
+    if (cfg.nvme_cmds) {
+        prep_nvme_read(sqe, dev->sqe_fd, page, pageSize, f.offset);
+        if (cfg.reg_bufs) {
+            int buf_idx = (f.bid * pageSize) / REG_BUF_SIZE;
+            sqe->uring_cmd_flags |= IORING_URING_CMD_FIXED;
+            sqe->buf_index = buf_idx;
         }
+    } else if (!cfg.reg_bufs) {
+        io_uring_prep_read(sqe, dev->sqe_fd, page, pageSize, f.offset);
+    } else {
+        int buf_idx = (f.bid * pageSize) / REG_BUF_SIZE;
+        io_uring_prep_read_fixed(sqe, dev->sqe_fd, page, pageSize, f.offset, buf_idx);
+    }
+
+    if (cfg.reg_fds) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
 
-        if (cfg.reg_fds) {
-            sqe->flags |= IOSQE_FIXED_FILE;
+// wakes the fixes that waited for the read (op is first in frame.waiting) and unlocks the page
+void BufferManager::finishFault(const Fault& f, mini::Op* op) {
+    if (op) {
+        auto& frame = buffer_frames[f.bid];
+        ensure(frame.waiting == op);
+        frame.waiting = frame.waiting->next; // skip self
+        while (frame.waiting) {
+            mini::wake(frame.waiting->ctx);
+            frame.waiting = frame.waiting->next;
         }
+    }
+
+    f.dev->inflight--;
+
+    if (do_log)
+        Logger::info("fiber=", *my_id, " read done pid=", f.pid, " bid=", f.bid);
+
+    auto* buf_ptr = page_table->find(f.pid);
+    assert(buf_ptr && "logical PID not resident");
+    buf_ptr->set_io_lock(false);
+
+    readCount++;
+}
+
+void BufferManager::handleFault(PID pid, bool prefetch) {
+    Fault f;
+    if (!startFault(pid, f, prefetch)) {
+        mini::yield();
+        return;
+    }
+
+    auto* page = pages + f.bid;
+    auto prep_sqe = [&](struct io_uring_sqe* sqe) {
+        prepRead(f, sqe);
     };
 
     auto prep_libaio = [&](struct iocb* cb) {
-        auto offset = pid * pageSize;
-        io_prep_pread(cb, ssd_fd, page, pageSize, offset);
+        io_prep_pread(cb, f.dev->fd, page, pageSize, f.offset);
     };
 
     if (sync_variant) {
@@ -273,8 +425,7 @@ void BufferManager::handleFault(PID pid) {
         clock.start();
 
         if (posix_variant) {
-            auto offset = pid * pageSize;
-            ensure(pread(ssd_fd, page, pageSize, offset) == pageSize);
+            ensure(pread(f.dev->fd, page, pageSize, f.offset) == pageSize);
         } else {
             struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
             check_ptr(sqe);
@@ -304,11 +455,12 @@ void BufferManager::handleFault(PID pid) {
 
         clock.stop();
         io_cycles += clock.cycles();
+        finishFault(f, nullptr);
 
     } else {
 
         mini::Op op;
-        frame.waiting = &op;
+        buffer_frames[f.bid].waiting = &op;
         int rc;
         if constexpr (mini::LIBAIO) {
             rc = mini::io(op, prep_libaio);
@@ -318,23 +470,89 @@ void BufferManager::handleFault(PID pid) {
         if (!cfg.nvme_cmds) {
             ensure(rc == pageSize);
         }
+        finishFault(f, &op);
+    }
+}
 
-        ensure(frame.waiting == &op);
-        frame.waiting = frame.waiting->next; // skip self
-        while (frame.waiting) {
-            mini::wake(frame.waiting->ctx);
-            frame.waiting = frame.waiting->next;
+// Reads several missing pages with one io_batch, for BTree::lookupBatch.
+// Pages faulted in by someone else in the meantime are skipped, if frames
+// run out only the ones that got a frame are read.
+void BufferManager::handleFaults(std::span<const PID> pids) {
+    if (sync_variant || pids.size() == 1) {
+        for (PID pid : pids) {
+            if (!page_table->find(pid)) {
+                handleFault(pid);
+            }
         }
+        return;
     }
 
-    if (do_log)
-        Logger::info("fiber=", *my_id, " read done pid=", pid, " bid=", bid);
+    ensure(pids.size() <= Config::kMaxMultiget);
+    Fault faults[Config::kMaxMultiget];
+    mini::Op heads[Config::kMaxMultiget]; // per frame chain head for handleWait, woken by finishFault
+    int n = 0;
+    for (PID pid : pids) {
+        if (page_table->find(pid)) {
+            continue;
+        }
+        if (!startFault(pid, faults[n])) {
+            break;
+        }
+        buffer_frames[faults[n].bid].waiting = &heads[n];
+        ++n;
+    }
+    if (n == 0) {
+        mini::yield();
+        return;
+    }
 
-    auto* buf_ptr = page_table->find(pid);
-    assert(buf_ptr && "logical PID not resident");
-    buf_ptr->set_io_lock(false);
+    auto prep_sqe = [&](int i, struct io_uring_sqe* sqe) {
+        prepRead(faults[i], sqe);
+    };
 
-    readCount++;
+    auto prep_libaio = [&](int i, struct iocb* cb) {
+        io_prep_pread(cb, faults[i].dev->fd, pages + faults[i].bid, pageSize, faults[i].offset);
+    };
+
+    mini::Op op;
+    if constexpr (mini::LIBAIO) {
+        mini::io_batch(n, op, prep_libaio);
+    } else {
+        mini::io_batch(n, op, prep_sqe);
+    }
+    if (!cfg.nvme_cmds) {
+        // no read returns more than pageSize, so this holds iff every page was read in full
+        ensure(op.total == static_cast<s64>(n * pageSize));
+    }
+    for (int i = 0; i < n; ++i) {
+        finishFault(faults[i], &heads[i]);
+    }
+    batchedFaults += n;
+}
+
+mini::co::Task<> BufferManager::handleFaultCo(PID pid) {
+    Fault f;
+    if (!startFault(pid, f)) {
+        co_await mini::co::yield();
+        co_return;
+    }
+
+    mini::Op op;
+    buffer_frames[f.bid].waiting = &op;
+    int rc;
+    if constexpr (mini::LIBAIO) {
+        rc = co_await mini::co::io(op, [&](struct iocb* cb) {
+            io_prep_pread(cb, f.dev->fd, pages + f.bid, pageSize, f.offset);
+        });
+    } else {
+        rc = co_await mini::co::io(op, [&](struct io_uring_sqe* sqe) {
+            prepRead(f, sqe);
+        });
+    }
+    if (!cfg.nvme_cmds) {
+        ensure(rc == pageSize);
+    }
+    finishFault(f, &op);
 }
 
 // helper type for the visitor
@@ -344,18 +562,33 @@ struct overloads : Ts... {
 };
 
 void BufferManager::handleRestart() {
+    if (deferRestarts && !std::holds_alternative<VersionException>(restart_ctx)) {
+        throw RestartDeferred{}; // the task awaits handleRestartCo() outside the BTree
+    }
     std::visit(overloads{
                    [&](PageFaultException& e) { bm.handleFault(e.pid); },
                    [&](RestartException& e) { bm.handleWait(e.bid); },
                    [&](AllocException&) { mini::yield(); },
+                   [&](LatchException&) { mini::yield(); },
+                   [&](VersionException&) {}, // the writer is done, retry right away
                },
                restart_ctx);
 }
 
-void BufferManager::handleWait(BID bid) {
+mini::co::Task<> BufferManager::handleRestartCo() {
+    if (auto* e = std::get_if<PageFaultException>(&restart_ctx)) {
+        co_await handleFaultCo(e->pid);
+    } else if (auto* e = std::get_if<RestartException>(&restart_ctx)) {
+        co_await handleWaitCo(e->bid);
+    } else if (!std::holds_alternative<VersionException>(restart_ctx)) {
+        co_await mini::co::yield(); // alloc or latch
+    }
+}
+
+// queues op behind the fiber reading the frame in, wakes with it
+void BufferManager::waitForRead(BID bid, mini::Op& op) {
     auto& frame = buffer_frames[bid];
 
-    mini::Op op;
     ensure(frame.waiting);
     if (frame.waiting) {
         // keep the io-initiated fiber front
@@ -369,18 +602,28 @@ void BufferManager::handleWait(BID bid) {
     ensure(buf_ptr->io_lock());
 
     op.ctx = mini::current();
+}
+
+void BufferManager::handleWait(BID bid) {
+    mini::Op op;
+    waitForRead(bid, op);
     mini::park();
 }
 
-Page* BufferManager::fixS(PID pid) {
-    if (do_log)
-        Logger::info("fiber=", *my_id, " fixS pid=", pid);
+mini::co::Task<> BufferManager::handleWaitCo(BID bid) {
+    mini::Op op;
+    waitForRead(bid, op);
+    co_await mini::co::park();
+}
 
+// resident, not being read in and not exclusively latched, otherwise sets restart_ctx
+BufTagged* BufferManager::lookupForFix(PID pid) {
     ++fixes;
 
     auto* buf_ptr = page_table->find(pid);
     if (!buf_ptr) {
         ++restarts;
+        ++misses;
         restart_ctx = PageFaultException(pid);
         return nullptr;
     }
@@ -392,115 +635,340 @@ Page* BufferManager::fixS(PID pid) {
         return nullptr;
     }
 
-    ensure(!buf_ptr->in_use());
-    buf_ptr->set_in_use(true);
-    buf_ptr->set_marked(true);
+    if (buf_ptr->in_use()) [[unlikely]] {
+        // only possible if the holder is parked on a cross-shard fix
+        ensure(cfg.shards > 1);
+        ++restarts;
+        restart_ctx = LatchException{};
+        return nullptr;
+    }
+    if (buf_ptr->prefetched()) {
+        buf_ptr->set_prefetched(false);
+        ++readaheadHits;
+    }
+    if (buf_ptr->fresh()) {
+        buf_ptr->set_fresh(false); // the fix that faulted it in
+    } else {
+        buf_ptr->set_marked(true);
+    }
+    return buf_ptr;
+}
+
+Page* BufferManager::fixO(PID pid, FrameHandle& handle) {
+    if (do_log)
+        Logger::info("fiber=", *my_id, " fixO pid=", pid);
+
+    auto* buf_ptr = lookupForFix(pid);
+    if (!buf_ptr) {
+        return nullptr;
+    }
+
+    BID bid = buf_ptr->id();
+    handle = {buf_ptr, page_table->epoch, bid, buffer_frames[bid].version};
+
+    auto* page = pages + bid;
+    ensure(isValidPtr(pages));
+    return page;
+}
+
+Page* BufferManager::fixS(PID pid, FrameHandle* handle) {
+    if (do_log)
+        Logger::info("fiber=", *my_id, " fixS pid=", pid);
+
+    if (!isLocal(pid)) {
+        return fixRemote(pid, Msg::FixS);
+    }
+
+    auto* buf_ptr = lookupForFix(pid);
+    if (!buf_ptr) {
+        return nullptr;
+    }
+
+    BID bid = buf_ptr->id();
+    auto& frame = buffer_frames[bid];
+    frame.readers++;
+
+    if (handle) {
+        *handle = {buf_ptr, page_table->epoch, bid, frame.version};
+    }
 
     auto* page = pages + bid;
     ensure(isValidPtr(pages));
     return page;
 }
 
-Page* BufferManager::fixX(PID pid) {
+Page* BufferManager::fixX(PID pid, FrameHandle* handle) {
     if (do_log)
         Logger::info("fiber=", *my_id, " fixX pid=", pid);
 
-    ++fixes;
+    if (!isLocal(pid)) {
+        return fixRemote(pid, Msg::FixX);
+    }
 
-    auto* buf_ptr = page_table->find(pid);
+    auto* buf_ptr = lookupForFix(pid);
     if (!buf_ptr) {
-        ++restarts;
-        restart_ctx = PageFaultException(pid);
         return nullptr;
     }
 
     BID bid = buf_ptr->id();
-    if (buf_ptr->io_lock()) {
+    auto& frame = buffer_frames[bid];
+    if (frame.readers) [[unlikely]] {
+        // shared fixes are only taken for other shards
+        ensure(cfg.shards > 1);
         ++restarts;
-        restart_ctx = RestartException(bid);
+        restart_ctx = LatchException{};
         return nullptr;
     }
-
-    ensure(!buf_ptr->in_use());
     buf_ptr->set_in_use(true);
-    buf_ptr->set_marked(true);
-    buf_ptr->set_dirty(true);
+    markDirty(buf_ptr);
+    ensureCleanPages();
+
+    if (handle) {
+        *handle = {buf_ptr, page_table->epoch, bid, frame.version};
+    }
 
     auto* page = pages + bid;
     ensure(isValidPtr(pages));
     return page;
 }
 
-void BufferManager::unfixS(PID pid) {
+Page* BufferManager::upgrade(PID pid, FrameHandle& handle) {
     if (do_log)
-        Logger::info("fiber=", *my_id, " unfixS pid=", pid);
+        Logger::info("fiber=", *my_id, " upgrade pid=", pid);
 
+    if (!isLocal(pid)) {
+        return fixRemote(pid, Msg::Upgrade);
+    }
+
+    if (!validate(handle)) {
+        restartVersion();
+        return nullptr;
+    }
+
+    // still resident: eviction would have bumped the version
+    auto* buf_ptr = resolve(pid, handle);
+    assert(buf_ptr && "logical PID not resident");
+    auto& frame = buffer_frames[handle.bid];
+    if (buf_ptr->in_use() || frame.readers) [[unlikely]] {
+        ensure(cfg.shards > 1);
+        ++restarts;
+        restart_ctx = LatchException{};
+        return nullptr;
+    }
+    buf_ptr->set_in_use(true);
+    markDirty(buf_ptr);
+    ensureCleanPages();
+
+    handle.buf = buf_ptr;
+    handle.epoch = page_table->epoch;
+    return pages + handle.bid;
+}
+
+// runs on the owner for a shared fix held by another shard
+Page* BufferManager::upgradeShared(PID pid) {
     auto* buf_ptr = page_table->find(pid);
     assert(buf_ptr && "logical PID not resident");
+    auto& frame = buffer_frames[buf_ptr->id()];
+    ensure(frame.readers > 0);
+    frame.readers--;
 
-    ensure(buf_ptr->in_use());
-    buf_ptr->set_in_use(false);
-    buf_ptr->set_marked(true);
+    if (buf_ptr->in_use() || frame.readers) {
+        ++restarts;
+        restart_ctx = LatchException{};
+        return nullptr;
+    }
+    buf_ptr->set_in_use(true);
+    markDirty(buf_ptr);
+    ensureCleanPages();
+    return pages + buf_ptr->id();
 }
 
-void BufferManager::unfixX(PID pid) {
+void BufferManager::unfixS(PID pid, FrameHandle handle) {
+    if (do_log)
+        Logger::info("fiber=", *my_id, " unfixS pid=", pid);
+
+    if (!isLocal(pid)) {
+        unfixRemote(pid, /*exclusive*/ false);
+        return;
+    }
+
+    auto* buf_ptr = resolve(pid, handle);
+    assert(buf_ptr && "logical PID not resident");
+
+    auto& frame = buffer_frames[buf_ptr->id()];
+    ensure(frame.readers > 0);
+    frame.readers--;
+}
+
+void BufferManager::unfixX(PID pid, FrameHandle handle) {
     if (do_log)
         Logger::info("fiber=", *my_id, " unfixX pid=", pid);
 
-    auto* buf_ptr = page_table->find(pid);
+    if (!isLocal(pid)) {
+        unfixRemote(pid, /*exclusive*/ true);
+        return;
+    }
+
+    auto* buf_ptr = resolve(pid, handle);
     assert(buf_ptr && "logical PID not resident");
 
     ensure(buf_ptr->in_use());
     buf_ptr->set_in_use(false);
-    buf_ptr->set_dirty(true);
-    buf_ptr->set_marked(true);
+    markDirty(buf_ptr);
+    buffer_frames[buf_ptr->id()].version++;
 
     ensure(!buf_ptr->io_lock());
 }
 
-void BufferManager::evict() {
-    toEvict.clear();
-    toWrite.clear();
+void BufferManager::restartVersion() {
+    ++restarts;
+    restart_ctx = VersionException{};
+}
 
-    uint64_t visited = 0;
+Page* BufferManager::fixRemote(PID pid, Msg kind) {
+    ++forwards;
 
-    write_clock.start();
+    RemoteFix req{.pid = pid, .kind = kind, .reply_fd = ring.ring_fd};
+    int owner_fd = peers[owner(pid)]->ring.ring_fd;
+    uint64_t data = reinterpret_cast<uint64_t>(&req) | Reactor::kMsgTag;
 
-    bool exhausted = page_table->clock_sweep_next([&](PID pid, BufTagged& buf) {
-        BID bid = buf.id();
-        auto& frame = buffer_frames[bid];
-        ensure(frame.pid == pid); // invariant
+    // completes once the owner posted the reply to our ring
+    mini::io(req.op, [&](struct io_uring_sqe* sqe) {
+        Reactor::prep_msg(sqe, owner_fd, data, static_cast<int>(kind));
+    });
 
-        visited++;
-        if (buf.in_use()) {
-            return false;
+    if (!req.page) {
+        ++restarts;
+        restart_ctx = LatchException{};
+    }
+    return req.page;
+}
+
+void BufferManager::unfixRemote(PID pid, bool exclusive) {
+    int kind = static_cast<int>(exclusive ? Msg::UnfixX : Msg::UnfixS);
+    // fire and forget, submitted with the next batch
+    r->send_msg(peers[owner(pid)]->ring.ring_fd, (pid << 1) | Reactor::kMsgTag, kind);
+}
+
+// runs on a remote fiber of the owning shard
+void BufferManager::serveRemote(RemoteFix& req) {
+    Page* page;
+    while (true) {
+        switch (req.kind) {
+            case Msg::FixS:
+                page = fixS(req.pid);
+                break;
+            case Msg::FixX:
+                page = fixX(req.pid);
+                break;
+            default:
+                ensure(req.kind == Msg::Upgrade);
+                page = upgradeShared(req.pid); // cannot fault, the requester holds it shared
+                break;
         }
-        if (buf.io_lock()) {
-            // read into this frame in progress
-            return false;
+        if (page || std::holds_alternative<LatchException>(restart_ctx)) {
+            // do not wait for latches, the requester might hold the latch we wait for
+            break;
         }
-        if (buf.evicting()) {
-            return false;
+        handleRestart();
+    }
+
+    int reply_fd = req.reply_fd;
+    req.page = page; // req is owned by the requester after the reply
+    r->send_msg(reply_fd, reinterpret_cast<uint64_t>(&req.op), 0);
+    r->submit();
+}
+
+// called by the reactor for every CQE posted by another shard
+void BufferManager::handleMessage(uint64_t data, int res) {
+    switch (static_cast<Msg>(res & 0xff)) {
+        case Msg::FixS:
+        case Msg::FixX:
+        case Msg::Upgrade: {
+            remoteQueue.push_back(reinterpret_cast<RemoteFix*>(data));
+            for (auto& f : remote_fibers) {
+                if (!f->running) {
+                    f->wakeup();
+                    break;
+                }
+            }
+            break;
+        }
+        case Msg::UnfixS:
+            unfixS(data >> 1);
+            break;
+        case Msg::UnfixX:
+            unfixX(data >> 1);
+            break;
+        case Msg::SetRoot: {
+            unsigned slot = (res >> 8) & 0xfff;
+            u32 height = res >> 20;
+            if (height > rootHeight.at(slot)) { // root splits can arrive out of order
+                rootHeight[slot] = height;
+                BID bid = page_table->find(0)->id();
+                auto* meta = reinterpret_cast<PID*>(pages + bid);
+                meta[slot] = data >> 1;
+                buffer_frames[bid].version++; // optimistic readers of the meta page restart
+            }
+            break;
         }
+    }
+}
 
-        // second chance eviction
-        if (buf.marked()) {
-            buf.set_marked(false);
-            return false;
+// caller updated its metadata page copy, tell the other shards
+void BufferManager::publishRoot(unsigned slot, PID root) {
+    if (rootHeight.size() <= slot) {
+        rootHeight.resize(slot + 1, 0);
+    }
+    u32 height = ++rootHeight[slot];
+    if (cfg.shards == 1) {
+        return;
+    }
+    ensure(slot < (1 << 12) && height < (1 << 11));
+    int res = static_cast<int>(Msg::SetRoot) | (slot << 8) | (height << 20);
+    for (auto* peer : peers) {
+        if (peer && peer != this) { // trees are created before the other shards start
+            r->send_msg(peer->ring.ring_fd, (root << 1) | Reactor::kMsgTag, res);
         }
-        ensure(pid != 0);
+    }
+    r->submit();
+}
 
-        buf.set_evicting(true);
+// root pid from our metadata copy was replaced by a split on another shard
+void BufferManager::restartStale() {
+    ++restarts;
+    restart_ctx = LatchException{};
+}
 
-        if (buf.dirty()) {
-            buf.set_dirty(false);
-            toWrite.push_back(bid);
-        } else {
-            toEvict.push_back(bid);
+// queues an asynchronous read, the page is not fixed
+void BufferManager::prefetch(PID pid) {
+    // PIDs read from a node that changed under an optimistic reader may never have been allocated
+    if (!isLocal(pid) || pid >= allocCount * cfg.shards || page_table->find(pid)) {
+        return;
+    }
+    // never evict for read-ahead, and bound the work a long scan can queue
+    if (freeFrames.size() <= freeFrames.low || prefetchQueue.size() >= prefetch_fibers.size() * 4) {
+        return;
+    }
+
+    prefetchQueue.push_back(pid);
+    for (auto& f : prefetch_fibers) {
+        if (!f->running) {
+            f->wakeup();
+            break;
         }
-        bool done = (toEvict.size() + toWrite.size()) == cfg.evict_batch;
-        return done;
-    });
+    }
+}
+
+// picks victims into toEvict and toWrite
+void BufferManager::collectVictims() {
+    toEvict.clear();
+    toWrite.clear();
+    cleanStalled = false; // the sweep clears marks and takes frames, the cleaner may find work again
+
+    write_clock.start();
+
+    evictVisited += policy->sweep(cfg.evict_batch);
     if (do_log) {
         static u64 old_sweep = 0;
         if (page_table->sweep_ < old_sweep) {
@@ -512,119 +980,22 @@ void BufferManager::evict() {
     // if (toWrite.size() != cfg.evict_batch) {
     //     Logger::info("write=", toWrite.size());
     // }
+}
 
-    if (toWrite.size() > 0) {
-        if (do_log)
-            Logger::info("fiber=", *my_id, " evicting: ", toWrite.size(), " pages");
-
-        auto prep_sqe = [&](int b, struct io_uring_sqe* sqe) {
-            BID bid = toWrite[b];
-            PID pid = buffer_frames[bid].pid;
-
-            Page* page = pages + bid;
-            u64 offset = pageSize * pid;
-
-            // Logger::info("write pid=", pid);
-
-            if (cfg.nvme_cmds) {
-                prep_nvme_write(sqe, ssd_fd, page, pageSize, offset);
-                if (cfg.reg_bufs) {
-                    int buf_idx = (bid * pageSize) / REG_BUF_SIZE;
-                    sqe->uring_cmd_flags |= IORING_URING_CMD_FIXED;
-                    sqe->buf_index = buf_idx;
-                }
-            } else if (!cfg.reg_bufs) {
-                io_uring_prep_write(sqe, ssd_fd, page, pageSize, offset);
-            } else {
-                int buf_idx = (bid * pageSize) / REG_BUF_SIZE;
-                io_uring_prep_write_fixed(sqe, ssd_fd, page, pageSize, offset, buf_idx);
-            }
-
-            if (cfg.reg_fds) {
-                sqe->flags |= IOSQE_FIXED_FILE;
-            }
-        };
-
-        auto prep_libaio = [&](int b, struct iocb* cb) {
-            BID bid = toWrite[b];
-            PID pid =
-                buffer_frames[bid]
-                    .pid; // we can avoid this lookup by saving pid+bid in toWrite
-
-            Page* page = pages + bid;
-            u64 offset = pageSize * pid;
-
-            io_prep_pwrite(cb, ssd_fd, page, pageSize, offset);
-        };
-
-        if (sync_variant) {
-            RDTSCClock clock(2.4_GHz);
-            clock.start();
-
-            if (posix_variant) {
-                for (size_t i = 0; i < toWrite.size(); ++i) {
-                    BID bid = toWrite[i];
-                    PID pid =
-                        buffer_frames[bid]
-                            .pid; // we can avoid this lookup by saving pid+bid in toWrite
-
-                    Page* page = pages + bid;
-                    u64 offset = pageSize * pid;
-
-                    ensure(pwrite(ssd_fd, page, pageSize, offset) == pageSize);
-                }
-            } else {
-                for (size_t i = 0; i < toWrite.size(); ++i) {
-                    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
-                    check_ptr(sqe);
-                    prep_sqe(i, sqe);
-                }
-
-                int left = toWrite.size();
-                while (true) {
-                    io_uring_submit_and_wait(&ring, left);
-                    int i = 0;
-                    uint32_t head;
-                    struct io_uring_cqe* cqe;
-                    io_uring_for_each_cqe(&ring, head, cqe) {
-                        ++i;
-                        check_iou(cqe->res);
-                        if (!cfg.nvme_cmds) {
-                            ensure(cqe->res == pageSize);
-                        }
-                    }
-                    io_uring_cq_advance(&ring, i);
-                    left -= i;
-                    if (left == 0) {
-                        break;
-                    }
-                }
-            }
-
-            clock.stop();
-            io_cycles += clock.cycles();
-
-        } else {
-            mini::Op op;
-            int rc;
-            if constexpr (mini::LIBAIO) {
-                rc = mini::io_batch(toWrite.size(), op, prep_libaio);
-            } else {
-                rc = mini::io_batch(toWrite.size(), op, prep_sqe);
-            }
-            if (!cfg.nvme_cmds) {
-                ensure(rc == pageSize);
-            }
-        }
-
-        writeCount += toWrite.size();
+void BufferManager::evict() {
+    collectVictims();
+    writePages(toWrite, evictPlan);
+    evictVictims();
+}
 
-        if (do_log)
-            Logger::info("fiber=", *my_id, " eviction done: ", toWrite.size(),
-                         " pages");
-    }
+mini::co::Task<> BufferManager::evictCo() {
+    collectVictims();
+    co_await writePagesCo(toWrite, evictPlan);
+    evictVictims();
+}
 
-    // 2. Evict chosen pages (based on timestamps)
+// drops the victims that were not referenced or dirtied while being written
+void BufferManager::evictVictims() {
     u64 evicted_count = 0;
     auto evictNow = [&](BID bid) {
         auto& frame = buffer_frames[bid];
@@ -636,8 +1007,7 @@ void BufferManager::evict() {
         ensure(buf_ptr->evicting());
         buf_ptr->set_evicting(false);
 
-        if (buf_ptr->in_use()) {
-            Logger::info("evict and in_use bid=", bid);
+        if (buf_ptr->in_use() || frame.readers) {
             // referenced while evicting
             return;
         }
@@ -646,10 +1016,15 @@ void BufferManager::evict() {
         }
 
         ensure(!buf_ptr->io_lock());
+        if (buf_ptr->prefetched()) {
+            ++readaheadWasted;
+        }
 
+        frame.version++; // optimistic readers of this frame restart
         bool deleted = page_table->erase(pid);
         ensure(deleted);
-        freeList.push_back(bid);
+        freeFrames.free(bid); // handed to the depot in magazines of evict_batch
+        policy->evicted(bid, pid);
 
         evicted_count++;
     };
@@ -660,4 +1035,262 @@ void BufferManager::evict() {
         evictNow(bid);
 
     physUsedCount -= evicted_count;
+    evictions += evicted_count;
+}
+
+// called by the eviction policy for a frame that passed evictable()
+void BufferManager::takeVictim(BufTagged& buf) {
+    BID bid = buf.id();
+    ensure(buffer_frames[bid].pid != 0);
+    buf.set_evicting(true);
+
+    if (buf.dirty()) {
+        buf.set_dirty(false);
+        --dirtyCount;
+        toWrite.push_back(bid);
+    } else {
+        toEvict.push_back(bid);
+    }
+}
+
+// Writes back dirty pages the clock hand will reach soon, so that evict()
+// mostly finds clean frames. Returns false if nothing was left to clean.
+// Without memory pressure all dirty pages stay marked and a pass scans the
+// whole table in vain, so after such a pass the cleaner is only woken again
+// once the evictor ran.
+bool BufferManager::clean() {
+    toClean.clear();
+
+    // frames behind the clock hand were just judged, restart right ahead of it
+    if (auto* hand = policy->tableHand()) {
+        if (((clean_hand - *hand) & (page_table->capacity() - 1)) > page_table->capacity() / 2) {
+            clean_hand = *hand;
+        }
+    }
+
+    page_table->sweep_next(clean_hand, [&](PID pid, BufTagged& buf) {
+        if (!buf.dirty() || buf.marked()) {
+            return false; // hot pages would be dirtied again right away
+        }
+        if (buf.in_use() || buf.io_lock() || buf.evicting()) {
+            return false;
+        }
+        ensure(pid != 0);
+
+        buf.set_evicting(true); // keeps evict() away until the write completed
+        buf.set_dirty(false);
+        --dirtyCount;
+        toClean.push_back(buf.id());
+        return toClean.size() == cfg.evict_batch;
+    });
+
+    cleanStalled = toClean.empty();
+    writePages(toClean, cleanPlan);
+    cleanCount += toClean.size();
+
+    for (BID bid : toClean) {
+        auto* buf_ptr = page_table->find(buffer_frames[bid].pid);
+        assert(buf_ptr && "logical PID not resident");
+        buf_ptr->set_evicting(false);
+    }
+    return !toClean.empty();
+}
+
+// Sorts by PID and merges pages that are adjacent on their device into one
+// write of at most cfg.max_write bytes. Fixed buffers and passthrough
+// commands take a single buffer, there the frames must be adjacent too.
+void BufferManager::planWrites(const std::vector<BID>& bids, WritePlan& plan) {
+    auto& sorted = plan.sorted;
+    auto& runs = plan.runs;
+    auto& iovs = plan.iovs;
+
+    sorted.clear();
+    runs.clear();
+    sorted.reserve(bids.size());
+    for (BID bid : bids) {
+        sorted.emplace_back(buffer_frames[bid].pid, bid);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    iovs.resize(sorted.size());
+    u64 max_run = std::max<u64>(1, cfg.max_write / pageSize);
+    bool single_buffer = cfg.nvme_cmds || cfg.reg_bufs;
+
+    for (u32 i = 0; i < sorted.size(); ++i) {
+        auto [pid, bid] = sorted[i];
+        auto [dev, offset] = locate(pid);
+        iovs[i] = {pages + bid, pageSize};
+
+        if (!runs.empty()) {
+            auto& run = runs.back();
+            BID first_bid = sorted[run.first].second;
+            bool adjacent = run.dev == dev && run.offset + run.count * pageSize == offset && run.count < max_run;
+            if (adjacent && single_buffer) {
+                adjacent = first_bid + run.count == bid &&
+                           (first_bid * pageSize) / REG_BUF_SIZE == (bid * pageSize) / REG_BUF_SIZE;
+            }
+            if (adjacent) {
+                run.count++;
+                continue;
+            }
+        }
+        runs.push_back({dev, offset, i, 1});
+    }
+
+    for (auto& run : runs) {
+        run.dev->inflight++;
+        run.dev->ios++;
+    }
+}
+
+void BufferManager::prepWrite(WritePlan& plan, int r, struct io_uring_sqe* sqe) {
+    auto& run = plan.runs[r];
+    BID bid = plan.sorted[run.first].second;
+    Page* page = pages + bid;
+    u32 len = run.count * pageSize;
+
+    // Logger::info("write pid=", plan.sorted[run.first].first, " pages=", run.count);
+
+    if (cfg.nvme_cmds) {
+        prep_nvme_write(sqe, run.dev->sqe_fd, page, len, run.offset);
+        if (cfg.reg_bufs) {
+            int buf_idx = (bid * pageSize) / REG_BUF_SIZE;
+            sqe->uring_cmd_flags |= IORING_URING_CMD_FIXED;
+            sqe->buf_index = buf_idx;
+        }
+    } else if (!cfg.reg_bufs) {
+        if (run.count == 1) {
+            io_uring_prep_write(sqe, run.dev->sqe_fd, page, len, run.offset);
+        } else {
+            io_uring_prep_writev(sqe, run.dev->sqe_fd, &plan.iovs[run.first], run.count, run.offset);
+        }
+    } else {
+        int buf_idx = (bid * pageSize) / REG_BUF_SIZE;
+        io_uring_prep_write_fixed(sqe, run.dev->sqe_fd, page, len, run.offset, buf_idx);
+    }
+
+    if (cfg.reg_fds) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
+
+void BufferManager::finishWrites(const WritePlan& plan) {
+    for (auto& run : plan.runs) {
+        run.dev->inflight--;
+    }
+    writeCount += plan.sorted.size();
+    mergedWrites += plan.sorted.size() - plan.runs.size();
+
+    if (do_log)
+        Logger::info("fiber=", *my_id, " write done: ", plan.sorted.size(),
+                     " pages in ", plan.runs.size(), " writes");
+}
+
+// writes back the given frames and waits for completion, callers own their kEvict flags
+// and the plan, which is reused across calls
+void BufferManager::writePages(const std::vector<BID>& bids, WritePlan& plan) {
+    if (bids.empty()) {
+        return;
+    }
+
+    if (do_log)
+        Logger::info("fiber=", *my_id, " writing: ", bids.size(), " pages");
+
+    planWrites(bids, plan);
+    auto& runs = plan.runs;
+    auto& iovs = plan.iovs;
+
+    auto prep_sqe = [&](int r, struct io_uring_sqe* sqe) {
+        prepWrite(plan, r, sqe);
+    };
+
+    auto prep_libaio = [&](int r, struct iocb* cb) {
+        auto& run = runs[r];
+        io_prep_pwritev(cb, run.dev->fd, &iovs[run.first], run.count, run.offset);
+    };
+
+    if (sync_variant) {
+        RDTSCClock clock(2.4_GHz);
+        clock.start();
+
+        if (posix_variant) {
+            for (auto& run : runs) {
+                ssize_t len = run.count * pageSize;
+                ensure(pwritev(run.dev->fd, &iovs[run.first], run.count, run.offset) == len);
+            }
+        } else {
+            for (size_t r = 0; r < runs.size(); ++r) {
+                struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                check_ptr(sqe);
+                prep_sqe(r, sqe);
+                io_uring_sqe_set_data64(sqe, r);
+            }
+
+            int left = runs.size();
+            while (true) {
+                io_uring_submit_and_wait(&ring, left);
+                int i = 0;
+                uint32_t head;
+                struct io_uring_cqe* cqe;
+                io_uring_for_each_cqe(&ring, head, cqe) {
+                    ++i;
+                    check_iou(cqe->res);
+                    if (!cfg.nvme_cmds) {
+                        ensure(cqe->res == static_cast<s32>(runs[cqe->user_data].count * pageSize));
+                    }
+                }
+                io_uring_cq_advance(&ring, i);
+                left -= i;
+                if (left == 0) {
+                    break;
+                }
+            }
+        }
+
+        clock.stop();
+        io_cycles += clock.cycles();
+
+    } else {
+        mini::Op op;
+        op.submit_clock = &write_clock;
+        if constexpr (mini::LIBAIO) {
+            mini::io_batch(runs.size(), op, prep_libaio);
+        } else {
+            mini::io_batch(runs.size(), op, prep_sqe);
+        }
+        write_cycles += write_clock.cycles();
+        if (!cfg.nvme_cmds) {
+            // no run is written beyond its length, so this holds iff every run was complete
+            ensure(op.total == static_cast<s64>(plan.sorted.size() * pageSize));
+        }
+    }
+
+    finishWrites(plan);
+}
+
+mini::co::Task<> BufferManager::writePagesCo(const std::vector<BID>& bids, WritePlan& plan) {
+    if (bids.empty()) {
+        co_return;
+    }
+
+    planWrites(bids, plan);
+
+    mini::Op op;
+    op.submit_clock = &write_clock;
+    if constexpr (mini::LIBAIO) {
+        co_await mini::co::io_batch(plan.runs.size(), op, [&](int r, struct iocb* cb) {
+            auto& run = plan.runs[r];
+            io_prep_pwritev(cb, run.dev->fd, &plan.iovs[run.first], run.count, run.offset);
+        });
+    } else {
+        co_await mini::co::io_batch(plan.runs.size(), op, [&](int r, struct io_uring_sqe* sqe) {
+            prepWrite(plan, r, sqe);
+        });
+    }
+    write_cycles += write_clock.cycles();
+    if (!cfg.nvme_cmds) {
+        ensure(op.total == static_cast<s64>(plan.sorted.size() * pageSize));
+    }
+
+    finishWrites(plan);
 }
@@ -2,8 +2,12 @@
 
 #include "boost/fiber/fss.hpp"
 #include "config.hpp"
+#include "coro.hpp"
+#include "eviction.hpp"
+#include "free_frames.hpp"
 #include "kuring.hpp"
 #include "rh_backshift_u64_map.hpp"
+#include "swiss_u64_map.hpp"
 #include "types.hpp"
 #include "utils/jmp.hpp"
 #include "utils/my_asserts.hpp"
@@ -15,6 +19,7 @@
 #include <fstream>
 #include <liburing.h>
 #include <list>
+#include <span>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -24,11 +29,14 @@ struct SleepingFiber {
     bool stop = false;
     bool running = false;
     std::unique_ptr<mini::Fiber> fiber;
-    Reactor::Fiber* ctx;
+    Reactor::Fiber* ctx = nullptr;
 
     template <typename SetupFn, typename LoopFn>
     void spawn(SetupFn&& setup_fn, LoopFn&& loop_fn) {
-        fiber = std::make_unique<mini::Fiber>([&] {
+        // the fiber first runs after spawn() returned, so own the callables
+        fiber = std::make_unique<mini::Fiber>([this,
+                                               setup_fn = std::forward<SetupFn>(setup_fn),
+                                               loop_fn = std::forward<LoopFn>(loop_fn)]() mutable {
             register_self();
             setup_fn();
 
@@ -68,13 +76,65 @@ struct SleepingFiber {
     }
 };
 
+// SleepingFiber as a stackless task (--coroutines), loop_fn returns Task<bool>
+struct SleepingTask {
+    bool stop = false;
+    bool running = false;
+    std::unique_ptr<mini::co::Spawned> task;
+    Reactor::Fiber* ctx = nullptr;
+
+    template <typename LoopFn>
+    void spawn(LoopFn loop_fn) {
+        task = std::make_unique<mini::co::Spawned>(loop(std::move(loop_fn)));
+    }
+
+    ~SleepingTask() {
+        stop = true;
+        wakeup();
+    }
+
+    void wakeup() {
+        if (running || !ctx) {
+            return;
+        }
+        running = true;
+        mini::wake(ctx);
+    }
+
+private:
+    template <typename LoopFn>
+    mini::co::Task<> loop(LoopFn loop_fn) {
+        ensure(!ctx);
+        ctx = mini::current();
+        running = true;
+
+        while (!stop) {
+            if (co_await loop_fn()) {
+                running = false;
+                co_await mini::co::park();
+            }
+        }
+    }
+};
+
 struct BufferFrame {
     PID pid; // page-id
     // FUring::Op* waiting = nullptr;
     mini::Op* waiting = nullptr;
+    // bumped by every exclusive unfix and whenever the frame changes its page,
+    // optimistic readers compare it on validation
+    u64 version = 0;
+    u32 readers = 0; // shared fixes, taken on behalf of other shards
 
     BufferFrame(PID pid) : pid(pid) {
     }
+
+    void reuse(PID newPid) {
+        pid = newPid;
+        waiting = nullptr;
+        readers = 0;
+        ++version;
+    }
 };
 
 struct PageFaultException {
@@ -87,6 +147,15 @@ struct RestartException {
 
 struct AllocException {};
 
+// page is latched by a fiber that is parked on a cross-shard request
+struct LatchException {};
+
+// an optimistic read was overtaken by a writer or eviction
+struct VersionException {};
+
+// thrown by handleRestart() under deferRestarts, the task awaits handleRestartCo()
+struct RestartDeferred {};
+
 
 struct BufTagged {
     static constexpr uint64_t kInUse = 1ull << 0;
@@ -94,9 +163,11 @@ struct BufTagged {
     static constexpr uint64_t kEvict = 1ull << 2;
     static constexpr uint64_t kIOLock = 1ull << 3;
     static constexpr uint64_t kMark = 1ull << 4;
+    static constexpr uint64_t kPrefetched = 1ull << 5; // read ahead, not yet fixed
+    static constexpr uint64_t kFresh = 1ull << 6;      // faulted in, the next fix is no reference
 
-    static constexpr uint64_t kFlagsMask = kInUse | kDirty | kEvict | kIOLock | kMark;
-    static constexpr unsigned kShift = 5;
+    static constexpr uint64_t kFlagsMask = kInUse | kDirty | kEvict | kIOLock | kMark | kPrefetched | kFresh;
+    static constexpr unsigned kShift = 7;
     static constexpr uint64_t kIdMask = ~kFlagsMask;
 
     uint64_t v = 0;
@@ -109,16 +180,30 @@ struct BufTagged {
     bool evicting() const { return v & kEvict; }
     bool io_lock() const { return v & kIOLock; }
     bool marked() const { return v & kMark; }
+    bool prefetched() const { return v & kPrefetched; }
+    bool fresh() const { return v & kFresh; }
 
     void set_in_use(bool b) { v = b ? (v | kInUse) : (v & ~kInUse); }
     void set_dirty(bool b) { v = b ? (v | kDirty) : (v & ~kDirty); }
     void set_evicting(bool b) { v = b ? (v | kEvict) : (v & ~kEvict); }
     void set_io_lock(bool b) { v = b ? (v | kIOLock) : (v & ~kIOLock); }
     void set_marked(bool b) { v = b ? (v | kMark) : (v & ~kMark); }
+    void set_prefetched(bool b) { v = b ? (v | kPrefetched) : (v & ~kPrefetched); }
+    void set_fresh(bool b) { v = b ? (v | kFresh) : (v & ~kFresh); }
 };
 
 
-using PageTable = RHBSU64Map<BufTagged>;
+// Kept by guards so unfix can skip the page table lookup. Valid while
+// the page is fixed and the table did not move entries (epoch).
+struct FrameHandle {
+    BufTagged* buf = nullptr; // nullptr: forwarded fix or none taken
+    u64 epoch = 0;
+    BID bid = 0;
+    u64 version = 0; // frame version at fix time, see BufferManager::validate
+};
+
+using PageTable = SwissU64Map<BufTagged>;
+// using PageTable = RHBSU64Map<BufTagged>;
 
 
 struct BufferManager {
@@ -131,10 +216,60 @@ struct BufferManager {
     bool do_log = false;
     Config cfg;
 
+    // Sharding: every worker thread owns one BufferManager (thread_local bm)
+    // with its own ring, reactor, frames and free list. PIDs are partitioned
+    // by pid % shards, fixes of foreign PIDs are forwarded to the owner.
+    // The metadata page (pid 0) is replicated, every shard keeps a copy.
+    unsigned shard_id = 0;
+    int numa_node = -1; // node of the shard's frames and page table with cfg.numa
+    static inline std::vector<BufferManager*> peers;
+
+    enum class Msg : int {
+        FixS,
+        FixX,
+        UnfixS,
+        UnfixX,
+        SetRoot,
+        Upgrade, // shared to exclusive, the shared fix is consumed either way
+    };
+
+    // lives on the requesting fiber's stack until the owner replied
+    struct RemoteFix {
+        mini::Op op = {};
+        PID pid;
+        Msg kind;
+        int reply_fd;
+        Page* page = nullptr; // nullptr: owner saw a latched page, restart
+    };
+
+    std::vector<RemoteFix*> remoteQueue;
+    std::vector<std::unique_ptr<SleepingFiber>> remote_fibers;
+    std::vector<u32> rootHeight; // per BTree slot, orders SetRoot messages
+
+    // scan read-ahead, see BTree::readAhead
+    std::vector<PID> prefetchQueue;
+    std::vector<std::unique_ptr<SleepingFiber>> prefetch_fibers;
+
     u64 page_count;
 
-    int blockfd; // TODO replace with SSD Raid
-    int ssd_fd;
+    // software RAID-0 over cfg.ssds, striped in units of cfg.stripe_pages
+    struct Device {
+        int fd;           // opened block device
+        int sqe_fd;       // registered file slot if cfg.reg_fds
+        u64 inflight = 0; // reads and writes not yet completed
+        u64 ios = 0;
+    };
+    std::vector<Device> devices;
+
+    // device and byte offset of a logical page
+    std::pair<Device*, u64> locate(PID pid) {
+        if (devices.size() == 1) [[likely]] {
+            return {&devices[0], pid * pageSize};
+        }
+        u64 stripe = pid / cfg.stripe_pages;
+        u64 block = (stripe / devices.size()) * cfg.stripe_pages + pid % cfg.stripe_pages;
+        return {&devices[stripe % devices.size()], block * pageSize};
+    }
 
     u64 allocCount = 1;    // pid 0 reserved for meta data
     u64 physUsedCount = 1; // metadata loaded
@@ -145,51 +280,165 @@ struct BufferManager {
     BufferFrame* buffer_frames;
     Page* pages;
 
-    // free physical slots (stack), buffer-ids
-    std::vector<BID> freeList;
+    // free physical slots, buffer-ids
+    FreeFrames freeFrames;
 
     u64 readCount = 0;
     u64 writeCount = 0;
+    u64 cleanCount = 0;   // writes issued by the cleaner
+    u64 mergedWrites = 0; // pages written as part of a larger write, I/Os saved
+    u64 dirtyCount = 0; // resident pages with kDirty set
     u64 fixes = 0;
     u64 restarts = 0;
-
-    using Exception = std::variant<PageFaultException, RestartException, AllocException>;
+    u64 forwards = 0; // fixes sent to another shard
+    u64 readaheadIssued = 0;
+    u64 readaheadHits = 0;   // fixed before eviction
+    u64 readaheadWasted = 0; // evicted without being fixed
+    u64 misses = 0;          // fixes that faulted
+    u64 batchedFaults = 0;   // pages read by handleFaults
+    u64 evictions = 0;
+    u64 evictVisited = 0; // frames looked at by the eviction policy
+
+    using Exception = std::variant<PageFaultException, RestartException, AllocException, LatchException, VersionException>;
     Exception restart_ctx;
 
     void handleRestart();
+    mini::co::Task<> handleRestartCo();
+
+    // Set around synchronous BTree calls made from coroutine tasks: instead of
+    // suspending, handleRestart() throws RestartDeferred and the task awaits
+    // handleRestartCo() before it retries the operation.
+    bool deferRestarts = false;
 
     static constexpr jmp::static_branch<bool> sync_variant = false;
     static constexpr jmp::static_branch<bool> posix_variant = false;
+    static constexpr jmp::static_branch<bool> frame_handles = false;
 
 
-    std::vector<BID> toEvict; // physical slots
-    std::vector<BID> toWrite; // physical slots
+    std::vector<BID> toEvict;  // physical slots
+    std::vector<BID> toWrite;  // physical slots
+    std::vector<BID> toClean;  // physical slots
+    size_t clean_hand = 0;     // page table slot, runs ahead of the clock hand
+    bool cleanStalled = false; // the last clean() found nothing, tried again after the next eviction round
+
+    std::unique_ptr<EvictionPolicy> policy;
+    // for eviction policies, frames that are latched, read in or already evicting stay
+    bool evictable(const BufTagged& buf) const {
+        BID bid = buf.id();
+        return !(buf.in_use() || buf.io_lock() || buf.evicting() || buffer_frames[bid].readers || bid == 0);
+    }
+    void takeVictim(BufTagged& buf);
 
     SleepingFiber eviction_fiber;
+    SleepingTask eviction_task; // instead of eviction_fiber with cfg.coroutines
+    SleepingFiber cleaner_fiber;
     boost::fibers::fiber_specific_ptr<uint64_t> my_id;
 
     BufferManager();
     ~BufferManager() {}
 
-    void init();
+    void init(unsigned shard = 0);
+
+    Page* fixX(PID pid, FrameHandle* handle = nullptr);
+    void unfixX(PID pid, FrameHandle handle = {});
+    Page* fixS(PID pid, FrameHandle* handle = nullptr);
+    void unfixS(PID pid, FrameHandle handle = {});
+
+    // Optimistic fix of a local page: takes no latch, so the caller must not
+    // trust what it read after parking until validate() succeeded.
+    Page* fixO(PID pid, FrameHandle& handle);
+    // shared/optimistic to exclusive, nullptr and restart_ctx set on failure
+    Page* upgrade(PID pid, FrameHandle& handle);
 
-    Page* fixX(PID pid);
-    void unfixX(PID pid);
-    Page* fixS(PID pid);
-    void unfixS(PID pid);
+    bool validate(const FrameHandle& handle) const {
+        return buffer_frames[handle.bid].version == handle.version;
+    }
+    void restartVersion();
+
+    BufTagged* resolve(PID pid, FrameHandle handle) {
+        if (frame_handles && handle.buf && handle.epoch == page_table->epoch) {
+            return handle.buf;
+        }
+        return page_table->find(pid);
+    }
 
 
     bool isValidPtr(void* page) {
         return (page >= pages) && (page < (pages + page_count));
     }
 
-    void ensureFreePages();
-    Page* allocPage();
+    unsigned owner(PID pid) const {
+        return pid == 0 ? shard_id : pid % cfg.shards;
+    }
+
+    bool isLocal(PID pid) const {
+        return cfg.shards == 1 || owner(pid) == shard_id;
+    }
 
-    void handleFault(PID pid);
+    Page* fixRemote(PID pid, Msg kind);
+    void unfixRemote(PID pid, bool exclusive);
+    void serveRemote(RemoteFix& req);
+    BufTagged* lookupForFix(PID pid);
+    Page* upgradeShared(PID pid);
+    void handleMessage(uint64_t data, int res);
+    void publishRoot(unsigned slot, PID root);
+    void restartStale();
+
+    void ensureCleanPages();
+    bool needsCleaning() const { return dirtyCount > physUsedCount * cfg.dirty_target; }
+
+    void markDirty(BufTagged* buf) {
+        if (!buf->dirty()) {
+            buf->set_dirty(true);
+            ++dirtyCount;
+        }
+    }
+    Page* allocPage(PID& pid);
+
+    // a page being read in by handleFault or handleFaultCo
+    struct Fault {
+        PID pid;
+        BID bid;
+        Device* dev;
+        u64 offset;
+    };
+    bool startFault(PID pid, Fault& f, bool prefetch = false);
+    void prepRead(const Fault& f, struct io_uring_sqe* sqe);
+    void finishFault(const Fault& f, mini::Op* op);
+
+    void handleFault(PID pid, bool prefetch = false);
+    void handleFaults(std::span<const PID> pids);
+    mini::co::Task<> handleFaultCo(PID pid);
+    void waitForRead(BID bid, mini::Op& op);
     void handleWait(BID bid);
+    mini::co::Task<> handleWaitCo(BID bid);
 
+    void prefetch(PID pid);
+    void collectVictims();
+    void evictVictims();
     void evict();
+    mini::co::Task<> evictCo();
+    bool clean();
+
+    // consecutive pages on one device, written with a single request
+    struct WriteRun {
+        Device* dev;
+        u64 offset;
+        u32 first; // index into sorted and iovs
+        u32 count;
+    };
+    struct WritePlan {
+        std::vector<std::pair<PID, BID>> sorted;
+        std::vector<WriteRun> runs;
+        std::vector<struct iovec> iovs;
+    };
+    WritePlan evictPlan; // toWrite, reused to not allocate per batch
+    WritePlan cleanPlan; // toClean, the cleaner writes concurrently to the evictor
+    void planWrites(const std::vector<BID>& bids, WritePlan& plan);
+    void prepWrite(WritePlan& plan, int r, struct io_uring_sqe* sqe);
+    void finishWrites(const WritePlan& plan);
+    void writePages(const std::vector<BID>& bids, WritePlan& plan);
+    mini::co::Task<> writePagesCo(const std::vector<BID>& bids, WritePlan& plan);
 
 
     // debug
@@ -209,4 +458,4 @@ struct BufferManager {
 };
 
 
-extern BufferManager bm;
+extern thread_local BufferManager bm;
@@ -13,6 +13,7 @@ BTree::BTree() : splitOrdered(false) {
     AllocGuard<BTreeNode> rootNode(true);
     slotId = btreeslotcounter++;
     page->roots[slotId] = rootNode.pid;
+    bm.publishRoot(slotId, rootNode.pid);
 }
 
 BTree::~BTree() {}
@@ -28,6 +29,7 @@ action_t BTree::trySplit(GuardX<BTreeNode>&& node, GuardX<BTreeNode>&& parent, s
         }
         newRoot->upperInnerNode = node.pid;
         metaData->roots[slotId] = newRoot.pid;
+        bm.publishRoot(slotId, newRoot.pid);
         parent = std::move(newRoot);
     }
 
@@ -59,7 +61,7 @@ void BTree::ensureSpace(BTreeNode* toSplit, std::span<u8> key, unsigned payloadL
                 goto restart;
             }
             GuardS<BTreeNode> node(reinterpret_cast<MetaDataPage*>(parent.ptr)->getRoot(slotId));
-            if (node.retry()) {
+            if (node.retry() || staleRoot(node)) {
                 goto restart;
             }
 
@@ -74,9 +76,14 @@ void BTree::ensureSpace(BTreeNode* toSplit, std::span<u8> key, unsigned payloadL
                 if (node->hasSpaceFor(key.size(), payloadLen))
                     return; // someone else did split concurrently
 
-                // upgrade always succeeds
                 GuardX<BTreeNode> parentLocked(std::move(parent));
+                if (parentLocked.retry()) {
+                    goto restart;
+                }
                 GuardX<BTreeNode> nodeLocked(std::move(node));
+                if (nodeLocked.retry()) {
+                    goto restart;
+                }
                 auto ret = trySplit(std::move(nodeLocked), std::move(parentLocked), key, payloadLen);
                 if (ret == action_t::RESTART) {
                     goto restart;
@@ -99,7 +106,7 @@ void BTree::insert(std::span<u8> key, std::span<u8> payload) {
                 goto restart;
             }
             GuardS<BTreeNode> node(reinterpret_cast<MetaDataPage*>(parent.ptr)->getRoot(slotId));
-            if (node.retry()) {
+            if (node.retry() || staleRoot(node)) {
                 goto restart;
             }
 
@@ -114,14 +121,24 @@ void BTree::insert(std::span<u8> key, std::span<u8> payload) {
             if (node->hasSpaceFor(key.size(), payload.size())) {
                 // only lock leaf
                 GuardX<BTreeNode> nodeLocked(std::move(node));
+                if (nodeLocked.retry()) {
+                    goto restart;
+                }
                 parent.release();
                 nodeLocked->insertInPage(key, payload);
+                wal.log(LogType::Insert, slotId, key, payload);
                 return; // success
             }
 
             // lock parent and leaf
             GuardX<BTreeNode> parentLocked(std::move(parent));
+            if (parentLocked.retry()) {
+                goto restart;
+            }
             GuardX<BTreeNode> nodeLocked(std::move(node));
+            if (nodeLocked.retry()) {
+                goto restart;
+            }
             auto ret = trySplit(std::move(nodeLocked), std::move(parentLocked), key, payload.size());
             if (ret == action_t::RESTART) {
                 goto restart;
@@ -142,7 +159,7 @@ bool BTree::remove(std::span<u8> key) {
                 goto restart;
             }
             GuardS<BTreeNode> node(reinterpret_cast<MetaDataPage*>(parent.ptr)->getRoot(slotId));
-            if (node.retry()) {
+            if (node.retry() || staleRoot(node)) {
                 goto restart;
             }
 
@@ -166,7 +183,13 @@ bool BTree::remove(std::span<u8> key) {
             if ((node->freeSpaceAfterCompaction() + sizeEntry >= BTreeNodeHeader::underFullSize) && (parent.pid != metadataPageId) && (parent->count >= 2) && ((pos + 1) < parent->count)) {
                 // underfull
                 GuardX<BTreeNode> parentLocked(std::move(parent));
+                if (parentLocked.retry()) {
+                    goto restart;
+                }
                 GuardX<BTreeNode> nodeLocked(std::move(node));
+                if (nodeLocked.retry()) {
+                    goto restart;
+                }
                 GuardX<BTreeNode> rightLocked(parentLocked->getChild(pos + 1)); // this might PageFault, no previous modifications
                 if (rightLocked.retry()) {
                     goto restart;
@@ -180,12 +203,142 @@ bool BTree::remove(std::span<u8> key) {
                 }
             } else {
                 GuardX<BTreeNode> nodeLocked(std::move(node));
+                if (nodeLocked.retry()) {
+                    goto restart;
+                }
                 parent.release();
                 nodeLocked->removeSlot(slotId);
             }
+            wal.log(LogType::Remove, this->slotId, key, {});
             return true;
         }
     restart:
         bm.handleRestart();
     }
 }
+
+
+BTree::BulkLoader::BulkLoader(BTree& tree, double fill) : tree(tree), limit(pageSize * fill) {
+    ensure(fill > 0 && fill <= 1);
+    GuardS<BTreeNode> root = tree.findLeafS({});
+    ensure(!root->hasUpperFence() && root->count == 0, "bulk loading needs an empty tree");
+}
+
+bool BTree::BulkLoader::append(std::span<u8> key, std::span<u8> payload) {
+    ensure(!finished);
+    if (!levels.empty() && !std::lexicographical_compare(last.begin(), last.end(), key.begin(), key.end())) {
+        return false;
+    }
+    add(0, key, payload);
+    last.assign(key.begin(), key.end());
+    return true;
+}
+
+// room for the entry and both fences, the upper one is at most this key
+bool BTree::BulkLoader::fits(Level& lvl, std::span<u8> key, std::span<u8> payload) {
+    auto& tmp = lvl.tmp;
+    unsigned needed = tmp.spaceNeeded(key.size(), payload.size()) + lvl.lower.size() + key.size();
+    if (needed > tmp.freeSpace()) {
+        return false;
+    }
+    return tmp.count == 0 || pageSize - tmp.freeSpace() + needed <= limit;
+}
+
+void BTree::BulkLoader::add(unsigned level, std::span<u8> key, std::span<u8> payload) {
+    if (level == levels.size()) {
+        bool isLeaf = level == 0;
+        levels.push_back(std::make_unique<Level>(allocNode(isLeaf), isLeaf));
+    }
+    Level& lvl = *levels[level];
+    if (!fits(lvl, key, payload)) {
+        close(level, key);
+    }
+    auto& tmp = lvl.tmp;
+    tmp.storeKeyValue(tmp.count, key, payload);
+    tmp.count++;
+}
+
+// writes the open node of level, next is the first key of the following one
+void BTree::BulkLoader::close(unsigned level, std::span<u8> next) {
+    Level& lvl = *levels[level];
+    auto& tmp = lvl.tmp;
+    bool isLeaf = tmp.isLeaf;
+    GuardX<BTreeNode> following = allocNode(isLeaf);
+
+    std::vector<u8> sep;
+    if (isLeaf) {
+        // shortest separator between the last key and next, as findSeparator
+        std::span<u8> lastKey = {tmp.getKey(tmp.count - 1), tmp.slot[tmp.count - 1].keyLen};
+        unsigned common = std::mismatch(lastKey.begin(), lastKey.end(), next.begin(), next.end()).first - lastKey.begin();
+        if (lastKey.size() > common && next.size() > common + 1) {
+            sep.assign(next.begin(), next.begin() + common + 1);
+        } else {
+            sep.assign(lastKey.begin(), lastKey.end());
+        }
+        lvl.page->nextLeafNode = following.pid;
+    } else {
+        // the last child becomes the upper one, its separator the fence
+        unsigned lastSlot = tmp.count - 1;
+        sep.assign(tmp.getKey(lastSlot), tmp.getKey(lastSlot) + tmp.slot[lastSlot].keyLen);
+        lvl.page->upperInnerNode = tmp.getChild(lastSlot);
+        tmp.removeSlot(lastSlot);
+    }
+    write(lvl, sep);
+
+    PID pid = lvl.page.pid;
+    lvl.page = std::move(following);
+    lvl.lower = sep;
+    new (&tmp) BTreeNode(isLeaf);
+    add(level + 1, sep, {reinterpret_cast<u8*>(&pid), sizeof(PID)});
+}
+
+void BTree::BulkLoader::write(Level& lvl, std::span<u8> upper) {
+    BTreeNode* node = lvl.page.ptr;
+    node->setFences(lvl.lower, upper);
+    lvl.tmp.copyKeyValueRange(node, 0, 0, lvl.tmp.count);
+    node->makeHint();
+    ++nodes;
+}
+
+void BTree::BulkLoader::finish() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+    if (levels.empty()) {
+        return; // nothing appended, keep the empty root
+    }
+
+    // the open node of every level is the rightmost one, the upper child of the level above
+    PID child = BTreeNode::noNeighbour;
+    for (auto& lvl : levels) {
+        if (!lvl->tmp.isLeaf) {
+            lvl->page->upperInnerNode = child;
+        }
+        write(*lvl, {});
+        child = lvl->page.pid;
+        lvl->page.release();
+    }
+    levels.clear();
+
+    while (true) {
+        GuardX<MetaDataPage> meta(metadataPageId);
+        if (meta.retry()) {
+            bm.handleRestart();
+            continue;
+        }
+        meta->roots[tree.slotId] = child; // the old empty root leaf is not reused
+        bm.publishRoot(tree.slotId, child);
+        return;
+    }
+}
+
+GuardX<BTreeNode> BTree::BulkLoader::allocNode(bool isLeaf) {
+    while (true) {
+        AllocGuard<BTreeNode> node(isLeaf);
+        if (!node.retry()) {
+            return node;
+        }
+        bm.handleRestart();
+    }
+}
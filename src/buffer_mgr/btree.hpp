@@ -3,8 +3,12 @@
 #include "btree_node.hpp"
 #include "config.hpp"
 #include "types.hpp"
+#include "wal.hpp"
 
+#include <algorithm>
+#include <memory>
 #include <span>
+#include <vector>
 
 static const PID metadataPageId = 0;
 
@@ -22,6 +26,34 @@ private:
     action_t trySplit(GuardX<BTreeNode>&& node, GuardX<BTreeNode>&& parent, std::span<u8> key, unsigned payloadLen);
     void ensureSpace(BTreeNode* toSplit, std::span<u8> key, unsigned payloadLen);
 
+    // Our metadata page copy can lag behind a root split on another shard.
+    // Only the root spans the whole key range, i.e. has no fences.
+    static bool staleRoot(GuardS<BTreeNode>& node) {
+        if (node->hasLowerFence() || node->hasUpperFence()) [[unlikely]] {
+            bm.restartStale();
+            return true;
+        }
+        return false;
+    }
+
+    // Queues reads for the leaves a scan reaches after leaf, the child at pos
+    // of parent. Past the last child only the right neighbour is known.
+    static void readAhead(BTreeNode& parent, unsigned pos, BTreeNode& leaf) {
+        unsigned k = bm.cfg.scan_readahead;
+        if (k == 0) {
+            return;
+        }
+        if (pos == parent.count) {
+            if (leaf.hasRightNeighbour()) {
+                bm.prefetch(leaf.nextLeafNode);
+            }
+            return;
+        }
+        for (unsigned i = pos + 1; i <= min(pos + k, unsigned(parent.count)); ++i) {
+            bm.prefetch(parent.childAt(i));
+        }
+    }
+
 public:
     unsigned slotId;
     bool splitOrdered;
@@ -55,25 +87,121 @@ public:
         return true;
     }
 
+    // Looks up several keys and overlaps their page faults: every round
+    // descends once for each open key without parking, the pages missing on
+    // the way are read in with one batch, then the next round starts.
+    // fn(i, payload) for every key i found, returns the number found.
+    // At most Config::kMaxMultiget keys.
+    template <class Fn>
+    unsigned lookupBatch(std::span<const std::span<u8>> keys, Fn fn) {
+        unsigned n = keys.size();
+        ensure(n <= Config::kMaxMultiget);
+        bool open[Config::kMaxMultiget];
+        PID faults[Config::kMaxMultiget];
+        std::fill_n(open, n, true);
+
+        unsigned found = 0;
+        unsigned left = n;
+        while (left > 0) {
+            unsigned numFaults = 0;
+            bool restart = false;
+            BufferManager::Exception ctx;
+            for (unsigned i = 0; i < n; ++i) {
+                if (!open[i]) {
+                    continue;
+                }
+                PID pid;
+                switch (probe(keys[i], [&](std::span<u8> payload) { fn(i, payload); }, pid)) {
+                    case Probe::Found:
+                        ++found;
+                        [[fallthrough]];
+                    case Probe::Missing:
+                        open[i] = false;
+                        --left;
+                        break;
+                    case Probe::Fault:
+                        if (std::find(faults, faults + numFaults, pid) == faults + numFaults) {
+                            faults[numFaults++] = pid; // inner nodes are shared by many keys
+                        }
+                        break;
+                    case Probe::Restart:
+                        restart = true;
+                        ctx = bm.restart_ctx;
+                        break;
+                }
+            }
+            if (numFaults > 0) {
+                bm.handleFaults({faults, numFaults});
+            } else if (restart) {
+                bm.restart_ctx = ctx; // waits for a read by someone else, or a latch
+                bm.handleRestart();
+            }
+        }
+        return found;
+    }
+
     void insert(std::span<u8> key, std::span<u8> payload);
     bool remove(std::span<u8> key);
 
+    // Builds an empty tree bottom-up from keys appended in ascending order.
+    // Every level has one open node that is filled in a scratch node up to
+    // `fill` of a page and written to its allocated page once the next entry
+    // does not fit, its separator goes to the level above. finish() writes
+    // the open nodes and installs the root, the tree must not be used before.
+    struct BulkLoader {
+        BulkLoader(BTree& tree, double fill);
+        ~BulkLoader() { finish(); }
+
+        // false if key is not above the last one, nothing is appended then
+        bool append(std::span<u8> key, std::span<u8> payload);
+        void finish();
+
+        u64 nodes = 0; // written so far
+
+    private:
+        struct Level {
+            GuardX<BTreeNode> page; // where the open node goes
+            BTreeNode tmp;          // open node, no fences and no prefix yet
+            std::vector<u8> lower;  // fence, separator of the previous node
+
+            Level(GuardX<BTreeNode>&& page, bool isLeaf) : page(std::move(page)), tmp(isLeaf) {}
+        };
+
+        BTree& tree;
+        unsigned limit; // bytes of a page to fill
+        std::vector<std::unique_ptr<Level>> levels;
+        std::vector<u8> last;
+        bool finished = false;
+
+        bool fits(Level& lvl, std::span<u8> key, std::span<u8> payload);
+        void add(unsigned level, std::span<u8> key, std::span<u8> payload);
+        void close(unsigned level, std::span<u8> next);
+        void write(Level& lvl, std::span<u8> upper);
+        static GuardX<BTreeNode> allocNode(bool isLeaf);
+    };
+
     template <class Fn>
     bool updateInPlace(std::span<u8> key, Fn fn) {
-        GuardS<BTreeNode> node = findLeafS(key);
-        bool found;
-        unsigned pos = node->lowerBound(key, found);
-        if (!found)
-            return false;
+        for (u64 repeatCounter = 0;; repeatCounter++) {
+            GuardS<BTreeNode> node = findLeafS(key);
+            bool found;
+            unsigned pos = node->lowerBound(key, found);
+            if (!found)
+                return false;
 
-        {
             GuardX<BTreeNode> nodeLocked(std::move(node));
+            if (nodeLocked.retry()) {
+                bm.handleRestart();
+                continue;
+            }
             fn(nodeLocked->getPayload(pos));
+            wal.log(LogType::Update, slotId, key, nodeLocked->getPayload(pos));
             return true;
         }
     }
 
-    GuardS<BTreeNode> findLeafS(std::span<u8> key) {
+    // readahead: queue the leaves after the found one, for the first leaf of a scan
+    GuardS<BTreeNode> findLeafS(std::span<u8> key, bool readahead = false) {
         for (u64 repeatCounter = 0;; repeatCounter++) {
             {
                 GuardS<MetaDataPage> meta(metadataPageId);
@@ -81,16 +209,28 @@ public:
                     goto restart;
                 }
                 GuardS<BTreeNode> node(meta->getRoot(slotId));
-                if (node.retry()) {
+                if (node.retry() || staleRoot(node)) {
+                    goto restart;
+                }
+                if (!meta.release()) {
                     goto restart;
                 }
-                meta.release();
 
                 while (node->isInner()) {
-                    node = GuardS<BTreeNode>(node->lookupInner(key));
-                    if (node.retry()) {
+                    unsigned pos = node->lowerBound(key);
+                    GuardS<BTreeNode> child(node->childAt(pos));
+                    if (child.retry()) {
                         goto restart;
                     }
+                    if (readahead && child->isLeaf) {
+                        // the fix may have parked (remote page), the parent may be reused by now
+                        if (!node.validate() || !child.validate()) {
+                            bm.restartVersion();
+                            goto restart;
+                        }
+                        readAhead(*node.ptr, pos, *child.ptr);
+                    }
+                    node = std::move(child);
                 }
 
                 return std::move(node);
@@ -101,7 +241,14 @@ public:
     }
 
 
-    GuardS<BTreeNode> findLeafSUpper(std::span<u8> key) {
+    enum class Probe { Found,
+                       Missing,
+                       Fault,    // pid is not resident
+                       Restart }; // restart_ctx is anything but a fault
+
+    // One lookup that returns instead of parking on a restart, for lookupBatch
+    template <class Fn>
+    Probe probe(std::span<u8> key, Fn&& fn, PID& fault) {
         for (u64 repeatCounter = 0;; repeatCounter++) {
             {
                 GuardS<MetaDataPage> meta(metadataPageId);
@@ -109,18 +256,72 @@ public:
                     goto restart;
                 }
                 GuardS<BTreeNode> node(meta->getRoot(slotId));
-                if (node.retry()) {
+                if (node.retry() || staleRoot(node)) {
+                    goto restart;
+                }
+                if (!meta.release()) {
                     goto restart;
                 }
-                meta.release();
 
                 while (node->isInner()) {
-                    node = GuardS<BTreeNode>(node->lookupInnerUpper(key));
+                    node = GuardS<BTreeNode>(node->lookupInner(key));
                     if (node.retry()) {
                         goto restart;
                     }
                 }
 
+                bool found;
+                unsigned pos = node->lowerBound(key, found);
+                if (!found)
+                    return Probe::Missing;
+                fn(node->getPayload(pos));
+                return Probe::Found;
+            }
+        restart:
+            if (auto* e = std::get_if<PageFaultException>(&bm.restart_ctx)) {
+                fault = e->pid;
+                return Probe::Fault;
+            }
+            if (!std::holds_alternative<VersionException>(bm.restart_ctx)) {
+                return Probe::Restart;
+            }
+            // the writer is done, retry right away
+        }
+    }
+
+
+    GuardS<BTreeNode> findLeafSUpper(std::span<u8> key) {
+        for (u64 repeatCounter = 0;; repeatCounter++) {
+            {
+                GuardS<MetaDataPage> meta(metadataPageId);
+                if (meta.retry()) {
+                    goto restart;
+                }
+                GuardS<BTreeNode> node(meta->getRoot(slotId));
+                if (node.retry() || staleRoot(node)) {
+                    goto restart;
+                }
+                if (!meta.release()) {
+                    goto restart;
+                }
+
+                while (node->isInner()) {
+                    unsigned pos = node->upperBound(key);
+                    GuardS<BTreeNode> child(node->childAt(pos));
+                    if (child.retry()) {
+                        goto restart;
+                    }
+                    if (child->isLeaf) {
+                        // the fix may have parked (remote page), the parent may be reused by now
+                        if (!node.validate() || !child.validate()) {
+                            bm.restartVersion();
+                            goto restart;
+                        }
+                        readAhead(*node.ptr, pos, *child.ptr);
+                    }
+                    node = std::move(child);
+                }
+
                 return std::move(node);
             }
         restart:
@@ -128,19 +329,24 @@ public:
         }
     }
 
+    // Leaves are read optimistically and only validated when they are left,
+    // fn must not park: nothing else runs on this shard while it does not.
     template <class Fn>
     void scanAsc(std::span<u8> key, Fn fn) {
-        GuardS<BTreeNode> node = findLeafS(key);
+        GuardS<BTreeNode> node = findLeafS(key, true);
 
         bool found;
         int pos = node->lowerBound(key, found);
         for (u64 repeatCounter = 0;; repeatCounter++) { // XXX
             if (pos < node->count) {
-                if (!fn(*node.ptr, pos))
+                if (!fn(*node.ptr, pos)) {
+                    ensure(node.release(), "scan callbacks must not park");
                     return;
+                }
                 pos++;
             } else {
                 if (!node->hasRightNeighbour()) {
+                    ensure(node.release(), "scan callbacks must not park");
                     return;
                 }
                 pos = 0;
@@ -151,7 +357,7 @@ public:
                 u8 buf[key.size()];
                 std::memcpy(buf, key.data(), key.size());
                 key = {buf, key.size()};
-                node.release();
+                ensure(node.release(), "scan callbacks must not park");
 
                 // avoid coupling for scan
                 node = findLeafSUpper(key);
@@ -160,6 +366,7 @@ public:
     }
 
 
+    // same contract as scanAsc
     template <class Fn>
     void scanDesc(std::span<u8> key, Fn fn) {
         GuardS<BTreeNode> node = findLeafS(key);
@@ -175,14 +382,22 @@ public:
         }
         for (u64 repeatCounter = 0;; repeatCounter++) { // XXX
             while (pos >= 0) {
-                if (!fn(*node.ptr, pos, exactMatch))
+                if (!fn(*node.ptr, pos, exactMatch)) {
+                    ensure(node.release(), "scan callbacks must not park");
                     return;
+                }
                 pos--;
             }
-            if (!node->hasLowerFence())
+            if (!node->hasLowerFence()) {
+                ensure(node.release(), "scan callbacks must not park");
                 return;
+            }
 
-            node = findLeafS(node->getLowerFence());
+            auto fence = node->getLowerFence();
+            u8 buf[fence.size()];
+            std::memcpy(buf, fence.data(), fence.size());
+            ensure(node.release(), "scan callbacks must not park");
+            node = findLeafS({buf, fence.size()});
             pos = node->count - 1;
         }
     }
@@ -5,9 +5,15 @@
 #include "guards.hpp"
 #include "types.hpp"
 #include "utils.hpp"
+#include "utils/jmp.hpp"
 
 #include <cassert>
+#include <cstddef>
 #include <span>
+#include <type_traits>
+
+// heap offsets fit into u16, only the initial dataOffset of a 64K page does not
+using PageOff = std::conditional_t<(pageSize < 65536), u16, u32>;
 
 struct BTreeNodeHeader {
     static constexpr unsigned underFullSize = (pageSize / 2) + (pageSize / 4); // merge nodes more empty
@@ -29,11 +35,12 @@ struct BTreeNodeHeader {
     FenceKeySlot upperFence = {0, 0}; // inclusive
 
     bool hasLowerFence() { return !!lowerFence.len; };
+    bool hasUpperFence() { return !!upperFence.len; };
 
     u16 count = 0;
     bool isLeaf;
-    u16 spaceUsed = 0;
-    u16 dataOffset = static_cast<u16>(pageSize);
+    PageOff spaceUsed = 0;
+    PageOff dataOffset = static_cast<PageOff>(pageSize);
     u16 prefixLen = 0;
 
     static constexpr unsigned hintCount = 16;
@@ -62,6 +69,8 @@ struct BTreeNode : public BTreeNodeHeader {
 
     static constexpr unsigned maxKVSize = ((pageSize - sizeof(BTreeNodeHeader) - (2 * sizeof(Slot)))) / 4;
 
+    static constexpr jmp::static_branch<bool> simd_search = false; // --simd_search
+
     BTreeNode(bool isLeaf) : BTreeNodeHeader(isLeaf) {}
 
     u8* ptr() { return reinterpret_cast<u8*>(this); }
@@ -118,6 +127,61 @@ struct BTreeNode : public BTreeNodeHeader {
         }
     }
 
+#ifdef __AVX512F__
+    // AVX-512 replacement for searchHint: checks all hints with one compare and
+    // then narrows [lowerOut, upperOut) with 16 gathered slot heads per step,
+    // evenly spaced while the range is larger than 16 and adjacent after that.
+    // Leaves only the slots whose head equals keyHead for the binary search.
+    void searchHeads(u32 keyHead, u16& lowerOut, u16& upperOut) {
+        const __m512i key = _mm512_set1_epi32(keyHead);
+        const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        const u8* heads = reinterpret_cast<const u8*>(slot) + offsetof(Slot, head);
+
+        if (count > hintCount * 2) {
+            u16 dist = upperOut / (hintCount + 1);
+            __m512i hints = _mm512_loadu_si512(hint);
+            unsigned ge = _mm512_cmpge_epu32_mask(hints, key);
+            unsigned pos = ge ? __builtin_ctz(ge) : hintCount;
+            unsigned ne = _mm512_cmpneq_epu32_mask(hints, key) & (~0u << pos);
+            unsigned pos2 = ne ? __builtin_ctz(ne) : hintCount;
+            lowerOut = pos * dist;
+            if (pos2 < hintCount)
+                upperOut = (pos2 + 1) * dist;
+        }
+
+        // sample lower + i * step for i = 1..16, all below upperOut
+        while (upperOut - lowerOut > 16) {
+            unsigned step = (upperOut - lowerOut) / (hintCount + 1);
+            __m512i idx = _mm512_mullo_epi32(_mm512_add_epi32(lanes, _mm512_set1_epi32(1)), _mm512_set1_epi32(step * sizeof(Slot)));
+            idx = _mm512_add_epi32(idx, _mm512_set1_epi32(lowerOut * sizeof(Slot)));
+            __m512i h = _mm512_i32gather_epi32(idx, heads, 1);
+            unsigned lt = __builtin_popcount(_mm512_cmplt_epu32_mask(h, key));
+            unsigned le = __builtin_popcount(_mm512_cmple_epu32_mask(h, key));
+            if (lt == 0 && le == 16)
+                return; // every sample has the key's head, only memcmp can tell
+            u16 lower = lowerOut;
+            if (lt > 0)
+                lowerOut = lower + lt * step + 1;
+            if (le < 16)
+                upperOut = lower + (le + 1) * step;
+        }
+
+        if (unsigned n = upperOut - lowerOut) {
+            __mmask16 valid = (1u << n) - 1;
+            __m512i idx = _mm512_mullo_epi32(_mm512_add_epi32(lanes, _mm512_set1_epi32(lowerOut)), _mm512_set1_epi32(sizeof(Slot)));
+            __m512i h = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), valid, idx, heads, 1);
+            unsigned lt = __builtin_popcount(_mm512_mask_cmplt_epu32_mask(valid, h, key));
+            unsigned le = __builtin_popcount(_mm512_mask_cmple_epu32_mask(valid, h, key));
+            upperOut = lowerOut + le;
+            lowerOut += lt;
+        }
+    }
+#else
+    void searchHeads(u32 keyHead, u16& lowerOut, u16& upperOut) {
+        searchHint(keyHead, lowerOut, upperOut);
+    }
+#endif
+
     // lower bound search, foundExactOut indicates if there is an exact match, returns slotId
     u16 lowerBound(std::span<u8> skey, bool& foundExactOut) {
         foundExactOut = false;
@@ -137,7 +201,11 @@ struct BTreeNode : public BTreeNodeHeader {
         u16 lower = 0;
         u16 upper = count;
         u32 keyHead = head(key, keyLen);
-        searchHint(keyHead, lower, upper);
+        if (simd_search) {
+            searchHeads(keyHead, lower, upper);
+        } else {
+            searchHint(keyHead, lower, upper);
+        }
 
         // binary search on remaining range
         while (lower < upper) {
@@ -192,7 +260,11 @@ struct BTreeNode : public BTreeNodeHeader {
         u16 lower = 0;
         u16 upper = count;
         u32 keyHead = head(key, keyLen);
-        searchHint(keyHead, lower, upper);
+        if (simd_search) {
+            searchHeads(keyHead, lower, upper);
+        } else {
+            searchHint(keyHead, lower, upper);
+        }
 
         // binary search on remaining range
         while (lower < upper) {
@@ -472,6 +544,12 @@ struct BTreeNode : public BTreeNodeHeader {
         return getChild(pos);
     }
 
+    PID childAt(unsigned pos) {
+        if (pos == count)
+            return upperInnerNode;
+        return getChild(pos);
+    }
+
     PID lookupInnerUpper(std::span<u8> key) {
         unsigned pos = upperBound(key);
         if (pos == count)
@@ -4,21 +4,93 @@
 // #include "furing.hpp"
 #include "kuring.hpp"
 #include "tpcc/tpcc_workload.hpp"
+#include "tx_latency.hpp"
 #include "utils.hpp"
 #include "utils/cpu_map.hpp"
 #include "utils/my_logger.hpp"
 #include "utils/stats_printer.hpp"
 #include "utils/stopper.hpp"
 #include "utils/utils.hpp"
+#include "wal.hpp"
 #include "ycsb_workload.hpp"
 
+#include <atomic>
+#include <barrier>
+#include <mutex>
+#include <thread>
+
+
+thread_local u64 scan_rows = 0; // records passed to scan callbacks
+
+
+// Key of the slot a scan is positioned on. Compared in folded form where it
+// lies on the page (prefix + suffix), copied and unfolded only by key().
+template <class Record>
+struct KeyView {
+    BTreeNode& node;
+    unsigned slot;
+
+    unsigned size() const { return node.prefixLen + node.slot[slot].keyLen; }
+
+    // memcmp order of the folded keys, a proper prefix orders first
+    int compare(std::span<const u8> folded) const {
+        unsigned p = std::min<size_t>(node.prefixLen, folded.size());
+        if (int cmp = memcmp(node.getPrefix(), folded.data(), p))
+            return cmp;
+        if (p < node.prefixLen)
+            return 1;
+        unsigned s = std::min<size_t>(node.slot[slot].keyLen, folded.size() - p);
+        if (int cmp = memcmp(node.getKey(slot), folded.data() + p, s))
+            return cmp;
+        return (size() > folded.size()) - (size() < folded.size());
+    }
+
+    // e.g. the folded leading fields from foldFields()
+    bool startsWith(std::span<const u8> folded) const {
+        if (size() < folded.size())
+            return false;
+        unsigned p = std::min<size_t>(node.prefixLen, folded.size());
+        return memcmp(node.getPrefix(), folded.data(), p) == 0 &&
+               memcmp(node.getKey(slot), folded.data() + p, folded.size() - p) == 0;
+    }
+
+    typename Record::Key key() const {
+        u8 kk[Record::maxFoldLength()];
+        memcpy(kk, node.getPrefix(), node.prefixLen);
+        memcpy(kk + node.prefixLen, node.getKey(slot), node.slot[slot].keyLen);
+        typename Record::Key typedKey;
+        Record::unfoldKey(kk, typedKey);
+        return typedKey;
+    }
+};
+
 
 template <class Record>
 struct Adapter {
     BTree tree;
+    std::unique_ptr<BTree::BulkLoader> bulk; // while loading with --bulk_fill
 
 public:
-    void scan(const typename Record::Key& key, const std::function<bool(const typename Record::Key&, const Record&)>& found_record_cb, std::function<void()> reset_if_scan_failed_cb) {
+    void beginBulk(double fill) {
+        bulk = std::make_unique<BTree::BulkLoader>(tree, fill);
+    }
+
+    void endBulk() {
+        bulk.reset(); // writes the open nodes
+    }
+
+    // records with a variable tail (ycsb_t) only store the part in use
+    static unsigned payloadSize(const Record& record) {
+        if constexpr (requires { Record::payloadSize(record); }) {
+            return Record::payloadSize(record);
+        } else {
+            return sizeof(Record);
+        }
+    }
+
+    // fn(KeyView, record) from the first key >= key on, until fn returns false
+    template <class Fn>
+    void scan(const typename Record::Key& key, Fn fn) {
         if (bm.do_log)
             Logger::info("fiber=", *bm.my_id, " scan");
 
@@ -26,21 +98,18 @@ public:
 
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        u8 kk[Record::maxFoldLength()];
         tree.scanAsc({k, l}, [&](BTreeNode& node, unsigned slot) {
-            memcpy(kk, node.getPrefix(), node.prefixLen);
-            memcpy(kk + node.prefixLen, node.getKey(slot), node.slot[slot].keyLen);
-            typename Record::Key typedKey;
-            Record::unfoldKey(kk, typedKey);
-            return found_record_cb(typedKey, *reinterpret_cast<const Record*>(node.getPayload(slot).data()));
+            ++scan_rows;
+            return fn(KeyView<Record>{node, slot}, *reinterpret_cast<const Record*>(node.getPayload(slot).data()));
         });
 
-
         if (bm.do_log)
             Logger::info("fiber=", *bm.my_id, " scan done");
     }
 
-    void scanDesc(const typename Record::Key& key, const std::function<bool(const typename Record::Key&, const Record&)>& found_record_cb, std::function<void()> reset_if_scan_failed_cb) {
+    // fn(KeyView, record) from the last key <= key down, until fn returns false
+    template <class Fn>
+    void scanDesc(const typename Record::Key& key, Fn fn) {
         if (bm.do_log)
             Logger::info("fiber=", *bm.my_id, " scanDesc");
 
@@ -48,7 +117,6 @@ public:
 
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        u8 kk[Record::maxFoldLength()];
         bool first = true;
         tree.scanDesc({k, l}, [&](BTreeNode& node, unsigned slot, bool exactMatch) {
             if (first) { // XXX: hack
@@ -56,11 +124,8 @@ public:
                 if (!exactMatch)
                     return true;
             }
-            memcpy(kk, node.getPrefix(), node.prefixLen);
-            memcpy(kk + node.prefixLen, node.getKey(slot), node.slot[slot].keyLen);
-            typename Record::Key typedKey;
-            Record::unfoldKey(kk, typedKey);
-            return found_record_cb(typedKey, *reinterpret_cast<const Record*>(node.getPayload(slot).data()));
+            ++scan_rows;
+            return fn(KeyView<Record>{node, slot}, *reinterpret_cast<const Record*>(node.getPayload(slot).data()));
         });
     }
 
@@ -72,24 +137,54 @@ public:
 
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        tree.insert({k, l}, {(u8*)(&record), sizeof(Record)});
+        if (bulk) {
+            if (bulk->append({k, l}, {(u8*)(&record), payloadSize(record)})) {
+                return;
+            }
+            endBulk(); // out of order, the rest goes through insert
+        }
+        tree.insert({k, l}, {(u8*)(&record), payloadSize(record)});
     }
 
+    // Returns false if the record was not found
     template <class Fn>
-    void lookup1(const typename Record::Key& key, Fn fn) {
+    bool lookup(const typename Record::Key& key, Fn fn) {
         if (bm.do_log)
-            Logger::info("fiber=", *bm.my_id, " lookup1");
+            Logger::info("fiber=", *bm.my_id, " lookup");
 
         // bm.ensureFreePages(); // previously in bm.alloc function
 
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        bool succ = tree.lookup({k, l}, [&](std::span<u8> payload) {
+        return tree.lookup({k, l}, [&](std::span<u8> payload) {
             fn(*reinterpret_cast<const Record*>(payload.data()));
         });
+    }
+
+    template <class Fn>
+    void lookup1(const typename Record::Key& key, Fn fn) {
+        bool succ = lookup(key, fn);
         assert(succ);
     }
 
+    // fn(i, record) for every keys[i] found, their page faults are read in together
+    template <class Fn>
+    void lookupBatch(std::span<const typename Record::Key> keys, Fn fn) {
+        if (bm.do_log)
+            Logger::info("fiber=", *bm.my_id, " lookupBatch n=", keys.size());
+
+        ensure(keys.size() <= Config::kMaxMultiget);
+        u8 k[Config::kMaxMultiget][Record::maxFoldLength()];
+        std::span<u8> folded[Config::kMaxMultiget];
+        for (size_t i = 0; i < keys.size(); ++i) {
+            folded[i] = {k[i], Record::foldKey(k[i], keys[i])};
+        }
+        unsigned found = tree.lookupBatch({folded, keys.size()}, [&](unsigned i, std::span<u8> payload) {
+            fn(i, *reinterpret_cast<const Record*>(payload.data()));
+        });
+        assert(found == keys.size());
+    }
+
     template <class Fn>
     void update1(const typename Record::Key& key, Fn fn) {
         if (bm.do_log)
@@ -166,271 +261,557 @@ T unfold(std::span<u8> payload) {
 }
 
 
-int tpcc() {
+// Runs fn(shard) once per shard. Shard 0 is the calling thread (initialized
+// in main), every other shard gets its own pinned thread, ring and reactor.
+template <class Fn>
+void run_shards(Fn&& fn) {
     auto& cfg = Config::get();
 
-    // TPC-C
-
-    Adapter<warehouse_t> warehouse;
-    Adapter<district_t> district;
-    Adapter<customer_t> customer;
-    Adapter<customer_wdl_t> customerwdl;
-    Adapter<history_t> history;
-    Adapter<neworder_t> neworder;
-    Adapter<order_t> order;
-    Adapter<order_wdc_t> order_wdc;
-    Adapter<orderline_t> orderline;
-    Adapter<item_t> item;
-    Adapter<stock_t> stock;
-
-
-    TPCCWorkload<Adapter> tpcc(warehouse, district, customer, customerwdl, history, neworder, order, order_wdc, orderline, item, stock, true, cfg.tpcc_warehouses, true);
-    // TPCCWorkload<Adapter> tpcc(warehouse, district, customer, customerwdl, history, neworder, order, order_wdc, orderline, item, stock, false, cfg.tpcc_warehouses, true);
-
-
-    // bm.do_log = true;
-    bool loaded = false;
-    mini::Fiber loader([&] {
-        bm.my_id.reset(new uint64_t{0xff}); // special id for loader
-
-        tpcc.loadItem();
-        tpcc.loadWarehouse();
-
-        for (Integer w_id = 1; w_id < cfg.tpcc_warehouses + 1; w_id++) {
-            tpcc.loadStock(w_id);
-            tpcc.loadDistrinct(w_id);
-            for (Integer d_id = 1; d_id <= 10; d_id++) {
-                tpcc.loadCustomer(w_id, d_id);
-                tpcc.loadOrders(w_id, d_id);
+    std::vector<std::jthread> threads;
+    for (int s = 1; s < cfg.shards; ++s) {
+        threads.emplace_back([&, s] {
+            if (cfg.core_id != -1) {
+                CPUMap::get().pin(cfg.core_id + s);
             }
-        }
-        loaded = true;
-    });
-    bm.r->run(loaded);
-    // loader.join();
-    Logger::info("space: ", (bm.allocCount * pageSize) / (float)1_GiB, " GB");
-    Logger::info("buffer_load=", bm.page_table->size() / static_cast<double>(bm.page_count));
-    // std::cin.get();
-
-
-    TimedStopper stopper;
-    stopper.after(std::chrono::milliseconds(cfg.duration));
-
-    uint64_t tps = 0;
+            bm.init(s);
+            fn(s);
+        });
+    }
+    fn(0);
+}
 
 
+// Per-shard variables are summed up by name, diagnostics are only printed for shard 0
+void register_stats(StatsPrinter::Scope& stats_scope, uint64_t& tps) {
     auto& stats = StatsPrinter::get();
+    auto& shard = bm; // the stats thread has its own thread_local bm
+
+    stats.register_aggr(stats_scope, tps, "tps");
+    stats.register_aggr(stats_scope, shard.readCount, "reads");
+    stats.register_aggr(stats_scope, shard.writeCount, "writes");
+    stats.register_aggr(stats_scope, shard.cleanCount, "cleaned");
+    stats.register_aggr(stats_scope, shard.mergedWrites, "merged_ios");
+    stats.register_aggr(stats_scope, io_cycles, "io_cycles");
+    stats.register_aggr(stats_scope, shard.allocCount, "allocs");
+    stats.register_aggr(stats_scope, shard.misses, "misses");
+    stats.register_aggr(stats_scope, shard.batchedFaults, "batched_reads");
+    stats.register_aggr(stats_scope, scan_rows, "scan_rows");
+    stats.register_aggr(stats_scope, shard.r->get_events, "get_events");
+    stats.register_aggr(stats_scope, shard.r->fiber_run, "fiber_run");
+    if (Config::get().steal) {
+        stats.register_aggr(stats_scope, shard.r->steals, "steals");
+    }
+    if (Config::get().shards > 1) {
+        stats.register_aggr(stats_scope, shard.forwards, "forwards");
+    }
+    if (Config::get().scan_readahead > 0) {
+        stats.register_aggr(stats_scope, shard.readaheadIssued, "ra_issued");
+        stats.register_aggr(stats_scope, shard.readaheadHits, "ra_hits");
+        stats.register_aggr(stats_scope, shard.readaheadWasted, "ra_wasted");
+    }
+    auto& log = wal;
+    if (!Config::get().wal.empty()) {
+        stats.register_aggr(stats_scope, log.commits, "commits");
+        stats.register_aggr(stats_scope, log.flushes, "log_flushes");
+        stats.register_aggr(stats_scope, log.bytesWritten, "log_bytes");
+    }
+    if (shard.shard_id != 0) {
+        return;
+    }
 
-    StatsPrinter::Scope stats_scope;
-    stats.register_var(stats_scope, tps, "tps");
-    stats.register_var(stats_scope, bm.readCount, "reads");
-    stats.register_var(stats_scope, bm.writeCount, "writes");
-    stats.register_var(stats_scope, io_cycles, "io_cycles");
-    stats.register_var(stats_scope, bm.allocCount, "allocs");
-    stats.register_var(stats_scope, bm.r->get_events, "get_events");
-    stats.register_func(stats_scope, [&](auto& ss) {
-        ss << " pt_%=" << bm.page_table->load_factor();
-        ss << " bm_%=" << bm.page_table->size() / static_cast<double>(bm.page_count);
+    stats.register_func(stats_scope, [&, wc = &write_cycles, fb = &mini::co::frame_bytes](auto& ss) {
+        ss << " pt_%=" << shard.page_table->load_factor();
+        ss << " bm_%=" << shard.page_table->size() / static_cast<double>(shard.page_count);
+        ss << " dirty_%=" << shard.dirtyCount / static_cast<double>(shard.physUsedCount);
         // ss << " io_out=" << furing_ptr->outstanding_io;
-        ss << " io_out=" << bm.r->outstanding_io;
+        ss << " io_out=" << shard.r->outstanding_io;
+        if (shard.devices.size() > 1) {
+            ss << " dev_io=";
+            for (auto& dev : shard.devices) {
+                ss << (&dev == &shard.devices[0] ? "" : ",") << dev.inflight;
+            }
+        }
 
         static Diff<uint64_t> reads_diff;
         static Diff<uint64_t> submit_diff;
-        ss << " reads/submit=" << reads_diff(bm.readCount) / static_cast<double>(submit_diff(bm.r->num_submits));
+        ss << " reads/submit=" << reads_diff(shard.readCount) / static_cast<double>(submit_diff(shard.r->num_submits));
+        if (Reactor::submit_adaptive) {
+            ss << " batch_target=" << shard.r->batcher.target;
+            ss << " batch_deadline_us=" << shard.r->batcher.deadline / 2.4e3;
+        }
+
 
+        // coroutine frames or fiber stacks (incl. loader, evictor, cleaner) per worker
+        auto task_bytes = Config::get().coroutines ? *fb : shard.r->stacks.reserved;
+        ss << " bytes/task=" << task_bytes / static_cast<double>(Config::get().concurrency);
 
         static Diff<uint64_t> writes_cycles;
         static Diff<uint64_t> writes_diff;
-        ss << " cycles/write=" << writes_cycles(write_cycles) / static_cast<double>(writes_diff(bm.writeCount));
+        ss << " cycles/write=" << writes_cycles(*wc) / static_cast<double>(writes_diff(shard.writeCount));
+
+        if (log.enabled) {
+            static Diff<uint64_t> commits_diff;
+            static Diff<uint64_t> commit_cycles;
+            static Diff<uint64_t> flushes_diff;
+            static Diff<uint64_t> flush_cycles;
+            auto commits = commits_diff(log.commits);
+            auto flushes = flushes_diff(log.flushes);
+            ss << " commit_us=" << commit_cycles(log.commitCycles) / 2.4e3 / static_cast<double>(commits);
+            ss << " commits/flush=" << commits / static_cast<double>(flushes);
+            ss << " flush_us=" << flush_cycles(log.flushCycles) / 2.4e3 / static_cast<double>(flushes);
+        }
     });
-    // stats.register_var(stats_scope, bm.fixes, "fixes");
+    stats.register_aggr(stats_scope, shard.fixes, "fixes");
     stats.register_func(stats_scope, [&](auto& ss) {
         static Diff<uint64_t> tps_diff;
         static Diff<uint64_t> fixes_diff;
         static Diff<uint64_t> restarts_diff;
         auto _tps = tps_diff(tps);
-        auto fixes_ps = _tps > 0 ? (fixes_diff(bm.fixes) / static_cast<double>(_tps)) : 0;
-        auto restarts_ps = _tps > 0 ? (restarts_diff(bm.restarts) / static_cast<double>(_tps)) : 0;
+        auto fixes_ps = _tps > 0 ? (fixes_diff(shard.fixes) / static_cast<double>(_tps)) : 0;
+        auto restarts_ps = _tps > 0 ? (restarts_diff(shard.restarts) / static_cast<double>(_tps)) : 0;
         ss << " fixes/txn=" << fixes_ps;
         ss << " restarts/txn=" << restarts_ps;
 
+        static Diff<uint64_t> hit_fixes;
+        static Diff<uint64_t> hit_misses;
+        static Diff<uint64_t> visited_diff;
+        static Diff<uint64_t> evictions_diff;
+        auto fixes = hit_fixes(shard.fixes);
+        auto misses = hit_misses(shard.misses);
+        ss << " hit_%=" << (fixes > 0 ? 1 - misses / static_cast<double>(fixes) : 0);
+        ss << " visited/evict=" << visited_diff(shard.evictVisited) / static_cast<double>(evictions_diff(shard.evictions));
+
         static Diff<uint64_t> io_diff;
         static Diff<uint64_t> get_diff;
-        auto gets = get_diff(bm.r->get_events);
+        auto gets = get_diff(shard.r->get_events);
         ss << " gets=" << gets;
-        ss << " cq/get=" << io_diff(bm.readCount + bm.writeCount) / static_cast<double>(gets);
+        ss << " cq/get=" << io_diff(shard.readCount + shard.writeCount) / static_cast<double>(gets);
 
 
         static RDTSCClock clock(2.4_GHz);
+        static Diff<uint64_t> ios_diff;
         clock.stop();
         ss << " total_cycles=" << clock.cycles();
+        ss << " cycles/io=" << clock.cycles() / static_cast<double>(ios_diff(shard.readCount + shard.writeCount));
         clock.start();
     });
-    stats.register_var(stats_scope, bm.r->fiber_run, "fiber_run");
+}
+
+
+void log_space(std::chrono::steady_clock::duration load_time) {
+    u64 allocs = 0;
+    for (auto* peer : BufferManager::peers) {
+        allocs += peer->allocCount;
+    }
+    Logger::info("load: ", std::chrono::duration<double>(load_time).count(), " s",
+                 Config::get().bulk_fill > 0 ? " (bulk)" : "");
+    Logger::info("space: ", (allocs * pageSize) / (float)1_GiB, " GB");
+    Logger::info("buffer_load=", bm.page_table->size() / static_cast<double>(bm.page_count));
+}
+
+
+thread_local uint64_t* shard_tps = nullptr;
+thread_local TxLatencies* shard_tx_latencies = nullptr; // with --tx_latency
+
+// One transaction on the warehouses of the worker's home shard, run by the
+// shard the worker is on. Out of line so that a worker that migrated between
+// two calls (--steal) looks up bm, wal and the reactor of its new thread.
+[[gnu::noinline]] static void tpcc_step(TPCCWorkload<Adapter>& tpcc, int home, int homes, int id) {
+    auto& cfg = Config::get();
+    // int w_id = tpcc.urand(1, cfg.tpcc_warehouses); // wh crossing
+    int w_id = home + 1 + cfg.shards * tpcc.urand(0, homes - 1); // home warehouse
+    u64 start = 0, run_start = 0;
+    if (shard_tx_latencies) {
+        start = RDTSCClock::read();
+        run_start = mini::run_cycles();
+    }
+    int tx_type = tpcc.tx(w_id);
+    wal.commit();
+    if (shard_tx_latencies) {
+        shard_tx_latencies->add(tx_type, RDTSCClock::read() - start, mini::run_cycles() - run_start);
+    }
+    if (bm.do_log)
+        Logger::info("fiber=", id, " ran tx_type=", tx_type);
+    ++*shard_tps;
 
-    // bm.do_log = true;
+    mini::R->check_submit();
+}
 
-    std::vector<mini::Fiber> fibers;
 
+int tpcc() {
+    auto& cfg = Config::get();
 
-    // bm.do_log = true;
+    // TPC-C
 
-    bm.readCount = 0;
-    bm.writeCount = 0;
+    Adapter<warehouse_t> warehouse;
+    Adapter<district_t> district;
+    Adapter<customer_t> customer;
+    Adapter<customer_wdl_t> customerwdl;
+    Adapter<history_t> history;
+    Adapter<neworder_t> neworder;
+    Adapter<order_t> order;
+    Adapter<order_wdc_t> order_wdc;
+    Adapter<orderline_t> orderline;
+    Adapter<item_t> item;
+    Adapter<stock_t> stock;
+
+
+    TPCCWorkload<Adapter> tpcc(warehouse, district, customer, customerwdl, history, neworder, order, order_wdc, orderline, item, stock, true, cfg.tpcc_warehouses, true);
+    // TPCCWorkload<Adapter> tpcc(warehouse, district, customer, customerwdl, history, neworder, order, order_wdc, orderline, item, stock, false, cfg.tpcc_warehouses, true);
 
-    auto fn = [&](int id) {
-        Logger::info("Fiber: ", id, " starting...");
-        bm.my_id.reset(new uint64_t{static_cast<uint64_t>(id)});
+    ensure(cfg.tpcc_warehouses >= cfg.shards, "every shard needs a home warehouse");
+    auto latencies = std::make_unique<TxLatencies[]>(cfg.shards);
+    TxLatencyWindow latency_window;
 
-        // while (stopper.can_run()) {
-        while (true) {
-            int w_id = tpcc.urand(1, cfg.tpcc_warehouses); // wh crossing
-            int tx_type = tpcc.tx(w_id);
-            if (bm.do_log)
-                Logger::info("fiber=", id, " ran tx_type=", tx_type);
-            ++tps;
+    // HTAP (--htap_scans): the first half of the run is TPC-C alone, in the
+    // second half scan fibers run CH Q6 next to it on every shard
+    constexpr unsigned kScanChunk = 1024; // orderline records between two yields
+    TimedStopper oltp_only;
+    std::atomic<uint64_t> alone_txs = 0, mixed_txs = 0, q6_rows_all = 0, q6_scans_all = 0;
+    std::chrono::steady_clock::time_point run_start, mixed_start;
 
-            mini::R->check_submit();
-            mini::yield();
+    // the stopper is shared, every shard leaves its reactor loop on the same flag
+    TimedStopper stopper;
+    std::barrier sync(cfg.shards);
+    std::atomic<int> loaded_shards = 0;
+    bool all_loaded = false;
+    auto load_start = std::chrono::steady_clock::now();
+
+    run_shards([&](int shard) {
+        workerThreadId = shard; // history keys are (thread_id, counter)
+        sync.arrive_and_wait(); // meta page copies are taken during init
+        if (cfg.steal) {
+            for (auto* peer : BufferManager::peers) {
+                if (peer != &bm) {
+                    bm.r->neighbours.push_back(peer->r.get());
+                }
+            }
         }
-    };
 
+        // bm.do_log = true;
+        mini::Fiber loader([&] {
+            bm.my_id.reset(new uint64_t{0xff}); // special id for loader
+
+            // keys are loaded in order, except for the secondary indexes
+            auto each_table = [&](auto fn) {
+                fn(warehouse);
+                fn(district);
+                fn(customer);
+                fn(customerwdl);
+                fn(history);
+                fn(neworder);
+                fn(order);
+                fn(order_wdc);
+                fn(orderline);
+                fn(item);
+                fn(stock);
+            };
+            if (cfg.bulk_fill > 0) {
+                each_table([&](auto& table) { table.beginBulk(cfg.bulk_fill); });
+            }
 
-    for (int i = 0; i < cfg.concurrency; ++i) {
-        fibers.emplace_back(fn, i);
-    }
+            if (shard == 0) {
+                tpcc.loadItem();
+                tpcc.loadWarehouse();
+            }
 
-    bm.r->run(stopper.triggered);
-    fibers.clear();
+            // warehouses are loaded by their home shard, so their pages are owned there
+            for (Integer w_id = shard + 1; w_id < cfg.tpcc_warehouses + 1; w_id += cfg.shards) {
+                tpcc.loadStock(w_id);
+                tpcc.loadDistrinct(w_id);
+                for (Integer d_id = 1; d_id <= 10; d_id++) {
+                    tpcc.loadCustomer(w_id, d_id);
+                    tpcc.loadOrders(w_id, d_id);
+                }
+            }
+            if (cfg.bulk_fill > 0) {
+                each_table([&](auto& table) { table.endBulk(); });
+            }
+            if (++loaded_shards == cfg.shards) {
+                all_loaded = true;
+            }
+        });
+        bm.r->run(all_loaded); // keep serving forwarded fixes until every shard is done
+        // loader.join();
+        sync.arrive_and_wait();
+        if (shard == 0) {
+            log_space(std::chrono::steady_clock::now() - load_start);
+            // std::cin.get();
+            stopper.after(std::chrono::milliseconds(cfg.duration));
+            if (cfg.htap_scans > 0) {
+                oltp_only.after(std::chrono::milliseconds(cfg.duration / 2));
+            }
+            run_start = std::chrono::steady_clock::now();
+        }
+        sync.arrive_and_wait();
+        wal.start(); // loading is not logged
 
-    // for (auto& f : fibers) {
-    //     f.join();
-    // }
 
-    return 0;
-}
+        uint64_t tps = 0;
+        uint64_t q6_rows = 0;
+        uint64_t q6_scans = 0;
 
+        StatsPrinter::Scope stats_scope;
+        register_stats(stats_scope, tps);
+        if (cfg.htap_scans > 0) {
+            StatsPrinter::get().register_aggr(stats_scope, q6_rows, "q6_rows");
+            StatsPrinter::get().register_aggr(stats_scope, q6_scans, "q6_scans");
+        }
+        if (!cfg.tx_latency.empty()) {
+            shard_tx_latencies = &latencies[shard];
+            if (shard == 0) {
+                StatsPrinter::get().register_func(stats_scope, [&](auto& ss) {
+                    latency_window.print(ss, latencies.get(), cfg.shards);
+                });
+            }
+        }
 
-u64 write_cycles = 0;
-RDTSCClock write_clock(2.4_GHz);
-u64 io_cycles = 0;
+        // bm.do_log = true;
 
-int ycsb() {
-    auto& cfg = Config::get();
+        std::vector<mini::Fiber> fibers;
 
-    Adapter<ycsb_t> table;
 
-    YCSBWorkload<Adapter> ycsb(table, cfg.ycsb_tuple_count, cfg.ycsb_read_ratio);
+        // bm.do_log = true;
 
+        bm.readCount = 0;
+        bm.writeCount = 0;
 
-    uint64_t tps = 0;
+        shard_tps = &tps;
+        int homes = (cfg.tpcc_warehouses - shard - 1) / cfg.shards + 1;
+        auto fn = [&, shard](int id) {
+            Logger::info("Fiber: ", id, " starting...");
+            bm.my_id.reset(new uint64_t{static_cast<uint64_t>(id)});
 
+            // while (stopper.can_run()) {
+            while (true) {
+                tpcc_step(tpcc, shard, homes, id);
+                if (cfg.steal) {
+                    mini::yield_stealable(); // may continue on another shard
+                } else {
+                    mini::yield();
+                }
+            }
+        };
 
-    auto& stats = StatsPrinter::get();
 
-    StatsPrinter::Scope stats_scope;
-    stats.register_var(stats_scope, tps, "tps");
-    stats.register_var(stats_scope, bm.readCount, "reads");
-    stats.register_var(stats_scope, bm.writeCount, "writes");
-    stats.register_var(stats_scope, io_cycles, "io_cycles");
-    stats.register_var(stats_scope, bm.allocCount, "allocs");
-    stats.register_var(stats_scope, bm.r->get_events, "get_events");
-    stats.register_func(stats_scope, [&](auto& ss) {
-        ss << " pt_%=" << bm.page_table->load_factor();
-        ss << " bm_%=" << bm.page_table->size() / static_cast<double>(bm.page_count);
-        // ss << " io_out=" << furing_ptr->outstanding_io;
-        ss << " io_out=" << bm.r->outstanding_io;
+        auto scan_fn = [&](int id) {
+            Logger::info("Scan fiber: ", id, " starting...");
+            bm.my_id.reset(new uint64_t{static_cast<uint64_t>(cfg.concurrency + id)});
 
-        static Diff<uint64_t> reads_diff;
-        static Diff<uint64_t> submit_diff;
-        ss << " reads/submit=" << reads_diff(bm.readCount) / static_cast<double>(submit_diff(bm.r->num_submits));
+            while (true) {
+                Numeric revenue = tpcc.chQuery6(kScanChunk, [] { mini::yield(); }, q6_rows);
+                do_not_optimize(revenue);
+                ++q6_scans;
+            }
+        };
 
 
-        static Diff<uint64_t> writes_cycles;
-        static Diff<uint64_t> writes_diff;
-        ss << " cycles/write=" << writes_cycles(write_cycles) / static_cast<double>(writes_diff(bm.writeCount));
-    });
-    // stats.register_var(stats_scope, bm.fixes, "fixes");
-    stats.register_func(stats_scope, [&](auto& ss) {
-        static Diff<uint64_t> tps_diff;
-        static Diff<uint64_t> fixes_diff;
-        static Diff<uint64_t> restarts_diff;
-        auto _tps = tps_diff(tps);
-        auto fixes_ps = _tps > 0 ? (fixes_diff(bm.fixes) / static_cast<double>(_tps)) : 0;
-        auto restarts_ps = _tps > 0 ? (restarts_diff(bm.restarts) / static_cast<double>(_tps)) : 0;
-        ss << " fixes/txn=" << fixes_ps;
-        ss << " restarts/txn=" << restarts_ps;
+        for (int i = 0; i < cfg.concurrency; ++i) {
+            fibers.emplace_back(fn, i);
+        }
 
-        static Diff<uint64_t> io_diff;
-        static Diff<uint64_t> get_diff;
-        auto gets = get_diff(bm.r->get_events);
-        ss << " gets=" << gets;
-        ss << " cq/get=" << io_diff(bm.readCount + bm.writeCount) / static_cast<double>(gets);
+        uint64_t alone = 0;
+        if (cfg.htap_scans > 0) {
+            bm.r->run(oltp_only.triggered);
+            alone = tps;
+            if (shard == 0) {
+                mixed_start = std::chrono::steady_clock::now();
+            }
+            for (int i = 0; i < cfg.htap_scans; ++i) {
+                fibers.emplace_back(scan_fn, i);
+            }
+        }
 
-        static RDTSCClock clock(2.4_GHz);
-        clock.stop();
-        ss << " total_cycles=" << clock.cycles();
-        clock.start();
+        bm.r->run(stopper.triggered);
+        sync.arrive_and_wait(); // parked fibers may still be referenced by forwarded fixes
+        fibers.clear();
+
+        if (cfg.htap_scans > 0) {
+            alone_txs += alone;
+            mixed_txs += tps - alone;
+            q6_rows_all += q6_rows;
+            q6_scans_all += q6_scans;
+            sync.arrive_and_wait();
+            if (shard == 0) {
+                auto end = std::chrono::steady_clock::now();
+                double alone_s = std::chrono::duration<double>(mixed_start - run_start).count();
+                double mixed_s = std::chrono::duration<double>(end - mixed_start).count();
+                double alone_tps = alone_txs / alone_s;
+                double mixed_tps = mixed_txs / mixed_s;
+                double row_bytes = sizeof(orderline_t::Key) + sizeof(orderline_t);
+                Logger::info("htap: oltp ", alone_tps, " tx/s alone, ", mixed_tps, " tx/s with scans (",
+                             100 * (mixed_tps - alone_tps) / alone_tps, "%)");
+                Logger::info("htap: ", q6_scans_all.load(), " q6 scans, ",
+                             q6_rows_all * row_bytes / mixed_s / 1_MiB, " MiB/s of orderline");
+            }
+        }
+
+        if (shard == 0 && !cfg.tx_latency.empty()) {
+            TxLatencies all;
+            for (int s = 0; s < cfg.shards; ++s) {
+                all.merge(latencies[s]);
+            }
+            all.write_csv(cfg.tx_latency);
+            Logger::info("tx latencies: ", cfg.tx_latency);
+        }
+
+        // for (auto& f : fibers) {
+        //     f.join();
+        // }
     });
-    stats.register_var(stats_scope, bm.r->fiber_run, "fiber_run");
 
+    return 0;
+}
 
-    bool loaded = false;
-    mini::Fiber loader([&] {
-        bm.my_id.reset(new uint64_t{0xff}); // special id for loader
 
-        ycsb.loadTable();
-        loaded = true;
-    });
-    bm.r->run(loaded);
-    Logger::info("space: ", (bm.allocCount * pageSize) / (float)1_GiB, " GB");
-    Logger::info("buffer_load=", bm.page_table->size() / static_cast<double>(bm.page_count));
+thread_local u64 write_cycles = 0;
+thread_local RDTSCClock write_clock(2.4_GHz);
+thread_local u64 io_cycles = 0;
+
+int ycsb() {
+    auto& cfg = Config::get();
+
+    Adapter<ycsb_t> table;
+
+    YCSBWorkload<Adapter> ycsb(table, cfg.ycsb_tuple_count, cfg.ycsb_read_ratio, cfg.ycsb_multiget,
+                               cfg.ycsb_workload, cfg.ycsb_theta, cfg.ycsb_scan_max, cfg.ycsb_value_min, cfg.ycsb_value_max);
+    ensure(sizeof(ycsb_t::Key) + offsetof(ycsb_t, value) + cfg.ycsb_value_max <= BTreeNode::maxKVSize, "ycsb values too large for the page size");
+    YCSBLatencies latencies; // of all shards
+    std::mutex latencies_mutex;
 
 
     TimedStopper stopper;
-    stopper.after(std::chrono::milliseconds(cfg.duration));
+    std::barrier sync(cfg.shards);
+    std::atomic<int> loaded_shards = 0;
+    bool all_loaded = false;
+    auto load_start = std::chrono::steady_clock::now();
 
-    std::vector<mini::Fiber> fibers;
+    run_shards([&](int shard) {
+        sync.arrive_and_wait(); // meta page copies are taken during init
 
-    // bm.do_log = true;
+        uint64_t tps = 0;
 
-    bm.readCount = 0;
-    bm.writeCount = 0;
+        StatsPrinter::Scope stats_scope;
+        register_stats(stats_scope, tps);
 
-    auto fn = [&](int id) {
-        Logger::info("Fiber: ", id, " starting...");
-        bm.my_id.reset(new uint64_t{static_cast<uint64_t>(id)});
 
-        // while (stopper.can_run()) {
-        while (true) {
-            int tx_type = ycsb.tx();
-            if (bm.do_log)
-                Logger::info("fiber=", id, " ran tx_type=", tx_type);
-            ++tps;
+        mini::Fiber loader([&] {
+            bm.my_id.reset(new uint64_t{0xff}); // special id for loader
 
-            mini::R->check_submit();
-            mini::yield();
+            u64 per_shard = cfg.ycsb_tuple_count / cfg.shards;
+            u64 end = shard + 1 == cfg.shards ? cfg.ycsb_tuple_count : (shard + 1) * per_shard;
+            if (cfg.bulk_fill > 0) {
+                table.beginBulk(cfg.bulk_fill);
+            }
+            ycsb.loadTable(shard * per_shard, end);
+            table.endBulk();
+            if (++loaded_shards == cfg.shards) {
+                all_loaded = true;
+            }
+        });
+        bm.r->run(all_loaded); // keep serving forwarded fixes until every shard is done
+        sync.arrive_and_wait();
+        if (shard == 0) {
+            log_space(std::chrono::steady_clock::now() - load_start);
+            stopper.after(std::chrono::milliseconds(cfg.duration));
         }
-    };
+        sync.arrive_and_wait();
+        wal.start(); // loading is not logged
+
+        std::vector<mini::Fiber> fibers;
+        std::vector<mini::co::Spawned> tasks;
+        YCSBLatencies shard_latencies;
+
+        // bm.do_log = true;
+
+        bm.readCount = 0;
+        bm.writeCount = 0;
+
+        auto fn = [&](int id) {
+            Logger::info("Fiber: ", id, " starting...");
+            bm.my_id.reset(new uint64_t{static_cast<uint64_t>(id)});
+
+            // while (stopper.can_run()) {
+            while (true) {
+                YCSBOp op = ycsb.next();
+                u64 start = RDTSCClock::read();
+                ycsb.run(op);
+                wal.commit();
+                shard_latencies.add(op.type, RDTSCClock::read() - start);
+                if (bm.do_log)
+                    Logger::info("fiber=", id, " ran tx_type=", op.type);
+                ++tps;
+
+                mini::R->check_submit();
+                mini::yield();
+            }
+        };
+
+        // same loop as a stackless task, the BTree runs synchronously and
+        // restarts are awaited here (--coroutines)
+        auto task = [&]() -> mini::co::Task<> {
+            while (true) {
+                YCSBOp op = ycsb.next();
+                u64 start = RDTSCClock::read();
+                while (true) {
+                    bool deferred = false;
+                    bm.deferRestarts = true;
+                    try {
+                        ycsb.run(op);
+                    } catch (RestartDeferred&) {
+                        deferred = true;
+                    }
+                    bm.deferRestarts = false;
+                    if (!deferred) {
+                        break;
+                    }
+                    co_await bm.handleRestartCo();
+                }
+                shard_latencies.add(op.type, RDTSCClock::read() - start);
+                ++tps;
+
+                mini::R->check_submit();
+                co_await mini::co::yield();
+            }
+        };
 
 
-    for (int i = 0; i < cfg.concurrency; ++i) {
-        fibers.emplace_back(fn, i);
-    }
+        if (cfg.coroutines) {
+            tasks.reserve(cfg.concurrency);
+            for (int i = 0; i < cfg.concurrency; ++i) {
+                tasks.emplace_back(task());
+            }
+        } else {
+            for (int i = 0; i < cfg.concurrency; ++i) {
+                fibers.emplace_back(fn, i);
+            }
+        }
+
+        bm.r->run(stopper.triggered);
+        sync.arrive_and_wait(); // parked fibers may still be referenced by forwarded fixes
+        fibers.clear();
+        tasks.clear();
 
-    bm.r->run(stopper.triggered);
-    fibers.clear();
+        {
+            std::lock_guard lock(latencies_mutex);
+            latencies.merge(shard_latencies);
+        }
+        sync.arrive_and_wait();
+        if (shard == 0) {
+            latencies.print();
+        }
 
-    // for (auto& f : fibers) {
-    //     f.join();
-    // }
+        // for (auto& f : fibers) {
+        //     f.join();
+        // }
+    });
 
     return 0;
 }
 
 
-BufferManager bm;
-
+thread_local BufferManager bm;
+thread_local WriteAheadLog wal;
 
 int main(int argc, char** argv) {
     if (!jmp::init()) { // enables run-time code patching
@@ -440,10 +821,21 @@ int main(int argc, char** argv) {
     cfg.parse(argc, argv);
 
     Reactor::submit_always = cfg.submit_always;
+    Reactor::submit_adaptive = cfg.submit_policy == "adaptive";
+    Reactor::work_stealing = cfg.steal;
+    Reactor::run_timing = !cfg.tx_latency.empty();
     BufferManager::sync_variant = cfg.sync_variant;
     BufferManager::posix_variant = cfg.posix_variant;
+    BufferManager::frame_handles = cfg.frame_handles;
+    BTreeNode::simd_search = cfg.simd_search;
 
     ensure(cfg.libaio == mini::LIBAIO);
+    if constexpr (mini::LIBAIO) {
+        ensure(cfg.concurrency < LibaioReactor::maxIOs, "libaio has a fixed number of iocbs");
+    }
+    if constexpr (mini::SIM) {
+        ensure(!cfg.sync_variant && !cfg.nvme_cmds && !cfg.reg_fds, "not supported by the simulated device");
+    }
 
     auto& stats = StatsPrinter::get();
     stats.interval = cfg.stats_interval;
@@ -12,39 +12,125 @@ void Config::parse(int argc, char** argv) {
     parser.parse("--nvme_cmds", nvme_cmds, cli::Parser::optional);
 
     parser.parse("--core_id", core_id, cli::Parser::optional);
+    parser.parse("--shards", shards, cli::Parser::optional);
+    parser.parse("--remote_fibers", remote_fibers, cli::Parser::optional);
+    parser.parse("--steal", steal, cli::Parser::optional);
+    parser.parse("--numa", numa, cli::Parser::optional);
     parser.parse("--stats_interval", stats_interval, cli::Parser::optional);
     parser.parse("--duration", duration, cli::Parser::optional);
 
 
-    parser.parse("--ssd", ssd);
+    parser.parse("--ssd", ssd, cli::Parser::optional);
+    parser.parse("--ssds", ssds, cli::Parser::optional);
+    parser.parse("--stripe_pages", stripe_pages, cli::Parser::optional);
     parser.parse("--virt_size", virt_size, cli::Parser::optional);
     parser.parse("--phys_size", phys_size, cli::Parser::optional);
     parser.parse("--concurrency", concurrency, cli::Parser::optional);
+    parser.parse("--fiber_stack", fiber_stack, cli::Parser::optional);
+    parser.parse("--coroutines", coroutines, cli::Parser::optional);
     parser.parse("--evict_batch", evict_batch, cli::Parser::optional);
+    parser.parse("--max_write", max_write, cli::Parser::optional);
     parser.parse("--free_target", free_target, cli::Parser::optional);
+    parser.parse("--free_high", free_high, cli::Parser::optional);
+    parser.parse("--dirty_target", dirty_target, cli::Parser::optional);
     parser.parse("--page_table_factor", page_table_factor, cli::Parser::optional);
+    parser.parse("--scan_readahead", scan_readahead, cli::Parser::optional);
+    parser.parse("--eviction", eviction, cli::Parser::optional);
+    parser.parse("--wal", wal, cli::Parser::optional);
+    parser.parse("--wal_size", wal_size, cli::Parser::optional);
+    parser.parse("--wal_buffer", wal_buffer, cli::Parser::optional);
 
     parser.parse("--workload", workload);
     parser.parse("--submit_always", submit_always, cli::Parser::optional);
+    parser.parse("--submit_policy", submit_policy, cli::Parser::optional);
     parser.parse("--sync_variant", sync_variant, cli::Parser::optional);
     parser.parse("--posix_variant", posix_variant, cli::Parser::optional);
+    parser.parse("--frame_handles", frame_handles, cli::Parser::optional);
+    parser.parse("--simd_search", simd_search, cli::Parser::optional);
     parser.parse("--ycsb_tuple_count", ycsb_tuple_count, cli::Parser::optional);
     parser.parse("--ycsb_read_ratio", ycsb_read_ratio, cli::Parser::optional);
+    parser.parse("--ycsb_multiget", ycsb_multiget, cli::Parser::optional);
+    parser.parse("--ycsb_workload", ycsb_workload, cli::Parser::optional);
+    parser.parse("--ycsb_theta", ycsb_theta, cli::Parser::optional);
+    parser.parse("--ycsb_scan_max", ycsb_scan_max, cli::Parser::optional);
+    parser.parse("--ycsb_value_min", ycsb_value_min, cli::Parser::optional);
+    parser.parse("--ycsb_value_max", ycsb_value_max, cli::Parser::optional);
     parser.parse("--tpcc_warehouses", tpcc_warehouses, cli::Parser::optional);
+    parser.parse("--tx_latency", tx_latency, cli::Parser::optional);
+    parser.parse("--htap_scans", htap_scans, cli::Parser::optional);
+    parser.parse("--bulk_fill", bulk_fill, cli::Parser::optional);
 
     parser.parse("--libaio", libaio, cli::Parser::optional);
+    parser.parse("--sim_latency", sim_latency, cli::Parser::optional);
+    parser.parse("--sim_read_us", sim_read_us, cli::Parser::optional);
+    parser.parse("--sim_write_us", sim_write_us, cli::Parser::optional);
+    parser.parse("--sim_disk_size", sim_disk_size, cli::Parser::optional);
 
     parser.check_unparsed();
     parser.print();
 
-    ensure(ssd.size() > 0);
+    if (ssd.size() > 0) {
+        ssds.insert(ssds.begin(), ssd);
+    }
+    ensure(ssds.size() > 0);
+    ensure(stripe_pages > 0);
 
     if (nvme_cmds) {
         // /dev/ng1n1
-        ensure(ssd.starts_with("/dev/ng"));
+        for (auto& dev : ssds) {
+            ensure(dev.starts_with("/dev/ng"));
+        }
+        ensure(wal.empty() || wal.starts_with("/dev/ng"));
+    }
+    if (!wal.empty()) {
+        ensure(wal_buffer % 4096 == 0 && wal_buffer <= wal_size / shards);
     }
 
     if (posix_variant) {
         ensure(sync_variant);
     }
+
+    ensure(dirty_target > 0 && dirty_target <= 1);
+    ensure(free_high >= free_target && free_high < 1);
+    ensure(scan_readahead >= 0);
+    ensure(fiber_stack >= 16_KiB && fiber_stack % 4_KiB == 0);
+    ensure(eviction == "clock" || eviction == "sieve" || eviction == "2q" || eviction == "arc");
+    ensure(ycsb_multiget >= 1 && ycsb_multiget <= kMaxMultiget, "--ycsb_multiget is limited to Config::kMaxMultiget");
+    ensure(ycsb_workload.empty() || (ycsb_workload.size() == 1 && ycsb_workload[0] >= 'a' && ycsb_workload[0] <= 'f'));
+    ensure(ycsb_theta >= 0 && ycsb_scan_max >= 1 && ycsb_value_min <= ycsb_value_max);
+    ensure(bulk_fill >= 0 && bulk_fill <= 1);
+#ifndef __AVX512F__
+    ensure(!simd_search, "built without AVX-512");
+#endif
+    if (bulk_fill > 0) {
+        // every shard loads its part into the same trees
+        ensure(shards == 1, "bulk loading needs a single shard");
+    }
+    ensure(sim_latency == "fixed" || sim_latency == "uniform" || sim_latency == "exp");
+    ensure(submit_policy == "random" || submit_policy == "adaptive");
+
+    ensure(shards >= 1);
+    if (numa) {
+        ensure(core_id != -1, "numa placement needs pinned shards");
+    }
+    if (shards > 1) {
+        // cross-shard fixes are forwarded with IORING_OP_MSG_RING
+        ensure(!libaio && !sync_variant);
+    }
+    if (steal) {
+        // a migrated fiber would take its log buffer along to another shard's WAL
+        ensure(workload == "tpcc" && wal.empty() && !coroutines);
+    }
+    if (!tx_latency.empty()) {
+        ensure(workload == "tpcc", "--tx_latency times TPC-C transactions");
+    }
+    ensure(htap_scans >= 0);
+    if (htap_scans > 0) {
+        ensure(workload == "tpcc", "--htap_scans runs next to TPC-C");
+    }
+    if (coroutines) {
+        // tasks restart outside the BTree, forwarded fixes and group commit park inside it
+        ensure(workload == "ycsb" && shards == 1 && wal.empty() && !sync_variant);
+        ensure(ycsb_multiget == 1, "lookupBatch parks inside the BTree");
+    }
 }
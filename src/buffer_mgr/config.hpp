@@ -6,7 +6,8 @@
 #include "utils/singleton.hpp"
 #include "utils/types.hpp"
 
-constexpr u64 pageSize = 4096;
+#include <string>
+#include <vector>
 
 struct Config : Singleton<Config> {
     SetupMode setup_mode = SetupMode::DEFER_TASKRUN;
@@ -17,29 +18,67 @@ struct Config : Singleton<Config> {
     bool nvme_cmds = false;
 
     int core_id = 64;
+    int shards = 1;         // worker threads, each owns a ring, reactor and PID partition
+    int remote_fibers = 16; // per shard, serve fixes forwarded by other shards
+    bool steal = false;     // idle shards take tpcc workers from busy ones between transactions
+    bool numa = false;      // bind each shard's frames and page table to the node it runs on
     uint32_t stats_interval = 1'000'000;
     uint32_t duration = 30'000;
 
     std::string ssd;
+    std::vector<std::string> ssds; // RAID-0, --ssd is the single device shorthand
+    uint32_t stripe_pages = 1;     // consecutive PIDs per device
     uint64_t virt_size = 16_GiB;
     uint64_t phys_size = 4_GiB;
     uint64_t evict_batch = 64;
+    uint64_t max_write = 128_KiB; // adjacent dirty pages are merged up to this size, pageSize disables it
     int concurrency = 1;
-    float free_target = 0.1;
+    uint64_t fiber_stack = 128_KiB; // pooled on huge pages, boost's default size
+    bool coroutines = false;        // ycsb workers and the evictor as stackless tasks instead of fibers
+    float free_target = 0.1; // low watermark, the evictor is woken below it
+    float free_high = 0.15;  // high watermark, the evictor keeps going until it is reached
+    float dirty_target = 0.25; // cleaner writes back while more resident pages are dirty, 1 disables it
     float page_table_factor = 1.5; // for ycsb choose 2.5
+    int scan_readahead = 8;        // leaves read ahead by scanAsc, also the number of prefetch fibers
+    std::string eviction = "clock"; // clock, sieve, 2q, arc
+
+    std::string wal;              // log device or file, empty disables logging
+    uint64_t wal_size = 4_GiB;    // split between shards, each wraps around in its part
+    uint64_t wal_buffer = 4_MiB;  // per shard group buffer, two of them
 
     std::string workload;
     bool submit_always = false;
+    std::string submit_policy = "random"; // random (ExpTable draws) or adaptive (SubmitBatcher)
     bool sync_variant = false;
     bool posix_variant = false;
+    bool frame_handles = true; // guards unfix through the fixed frame instead of a page table lookup
+    bool simd_search = false;  // AVX-512 search over the slot heads in BTreeNode
 
     uint64_t ycsb_tuple_count = 100;
     int ycsb_read_ratio = 50;
+    unsigned ycsb_multiget = 1;    // keys per read, looked up in one batch
+    std::string ycsb_workload;     // core workload a-f, empty mixes reads and updates by ycsb_read_ratio
+    double ycsb_theta = 0;         // Zipf skew of the keys, 0 is uniform (YCSB uses 0.99)
+    unsigned ycsb_scan_max = 100;  // e scans 1 to this many records
+    unsigned ycsb_value_min = 128; // value sizes are uniform in [min, max]
+    unsigned ycsb_value_max = 128;
+    // lookupBatch and handleFaults keep their batch on the fiber stack
+    static constexpr unsigned kMaxMultiget = 32;
 
     int tpcc_warehouses = 1;
+    std::string tx_latency; // csv for latency percentiles per transaction type, empty does not time them
+    int htap_scans = 0;     // fibers per shard running CH Q6 over orderline in the second half of a tpcc run
+
+    float bulk_fill = 0; // load sorted keys bottom-up with nodes filled this far, 0 inserts one by one
 
     bool libaio = false;
 
+    // buffer_mgr_sim: --ssd/--ssds only name the simulated devices
+    std::string sim_latency = "fixed"; // fixed, uniform, exp
+    uint64_t sim_read_us = 80;
+    uint64_t sim_write_us = 20;
+    uint64_t sim_disk_size = 1_TiB;    // sparse, per device and shard, holds the pages locate() maps to it
+
 
     void parse(int argc, char** argv);
 };
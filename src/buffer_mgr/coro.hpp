@@ -0,0 +1,200 @@
+#pragma once
+
+#include "kuring.hpp"
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+// Stackless C++20 tasks on the same reactor as mini::Fiber.
+//
+// A spawned task gets a Reactor::Fiber control block without a stack. Awaiting
+// I/O queues the request exactly like mini::io and returns to the reactor; the
+// completion wakes the control block and the reactor resumes the innermost
+// suspended coroutine. Op, wake() and the ready queue are shared with fibers,
+// so fibers and tasks can wait for each other. Awaited tasks resume their
+// caller directly (symmetric transfer). Blocking calls (mini::io, park, yield)
+// must not be used from a task.
+//
+//   mini::co::Task<int> read(...) {
+//       mini::Op op;
+//       co_return co_await mini::co::io(op, prep);
+//   }
+//   mini::co::Spawned t(read(...)); // starts once the reactor gets to it
+
+namespace mini::co {
+
+inline thread_local uint64_t frame_bytes = 0; // live coroutine frames of this thread
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation; // awaiting task, none if spawned
+    std::exception_ptr error;
+
+    static void* operator new(size_t size) {
+        frame_bytes += size;
+        return ::operator new(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        frame_bytes -= size;
+        ::operator delete(ptr, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            if (auto next = h.promise().continuation) {
+                return next;
+            }
+            R->current()->state = Reactor::State::Finished;
+            return std::noop_coroutine(); // back to the reactor
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() {
+        if (!continuation) {
+            throw; // spawned task, reaches the reactor like from a fiber
+        }
+        error = std::current_exception();
+    }
+};
+
+template <class T>
+struct Result {
+    T value{};
+    void return_value(T v) { value = std::move(v); }
+    T take() { return std::move(value); }
+};
+
+template <>
+struct Result<void> {
+    void return_void() {}
+    void take() {}
+};
+
+} // namespace detail
+
+
+template <class T = void>
+struct [[nodiscard]] Task {
+    struct promise_type : detail::PromiseBase, detail::Result<T> {
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+    };
+
+    std::coroutine_handle<promise_type> h;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : h(h) {}
+    Task(Task&& other) noexcept : h(std::exchange(other.h, {})) {}
+    Task& operator=(Task&&) = delete;
+    ~Task() {
+        if (h) {
+            h.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        h.promise().continuation = caller;
+        return h;
+    }
+    T await_resume() {
+        if (h.promise().error) {
+            std::rethrow_exception(h.promise().error);
+        }
+        return h.promise().take();
+    }
+};
+
+
+// Owns a spawned task: its frame and its control block
+struct Spawned {
+    Task<> task;
+
+    explicit Spawned(Task<> t) : task(std::move(t)) {
+        ensure(R, "mini::set_reactor(r) must be called before spawning tasks");
+        fiber = std::unique_ptr<Reactor::Fiber, Release>(R->new_fiber(), Release{R});
+        R->spawn_task(fiber.get(), task.h);
+    }
+
+    bool finished() const { return fiber->state == Reactor::State::Finished; }
+
+private:
+    struct Release {
+        Reactor* r;
+        void operator()(Reactor::Fiber* f) const { r->delete_fiber(f); }
+    };
+    std::unique_ptr<Reactor::Fiber, Release> fiber;
+};
+
+
+template <class Prep>
+struct IoAwaiter {
+    Reactor::Op& op;
+    Prep prep;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        R->queue_io(op, prep);
+        R->park_task(h);
+    }
+    int await_resume() const noexcept { return op.res; }
+};
+
+template <class Prep>
+struct IoBatchAwaiter {
+    int n;
+    Reactor::Op& op;
+    Prep prep;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        R->queue_io_batch(n, op, prep);
+        R->park_task(h);
+    }
+    int await_resume() const noexcept { return op.res; }
+};
+
+// co_await mini::co::io(op, prep), same contract as mini::io
+template <class Prep>
+inline IoAwaiter<std::decay_t<Prep>> io(Reactor::Op& op, Prep&& prep) {
+    return {op, std::forward<Prep>(prep)};
+}
+
+template <class Prep>
+inline IoBatchAwaiter<std::decay_t<Prep>> io_batch(int n, Reactor::Op& op, Prep&& prep) {
+    return {n, op, std::forward<Prep>(prep)};
+}
+
+// until someone calls mini::wake() on the control block
+inline auto park() {
+    struct Awaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { R->park_task(h); }
+        void await_resume() const noexcept {}
+    };
+    return Awaiter{};
+}
+
+inline auto yield() {
+    struct Awaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { R->yield_task(h); }
+        void await_resume() const noexcept {}
+    };
+    return Awaiter{};
+}
+
+} // namespace mini::co
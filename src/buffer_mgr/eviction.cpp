@@ -0,0 +1,252 @@
+#include "eviction.hpp"
+
+#include "bm.hpp"
+#include "utils/my_asserts.hpp"
+
+#include <algorithm>
+
+
+namespace {
+
+// page table entry of a resident frame
+BufTagged& entry(BufferManager& bm, BID bid) {
+    auto* buf = bm.page_table->find(bm.buffer_frames[bid].pid);
+    assert(buf && "logical PID not resident");
+    return *buf;
+}
+
+
+// second chance in page table slot order, no extra state
+struct ClockPolicy : EvictionPolicy {
+    explicit ClockPolicy(BufferManager& bm) : EvictionPolicy(bm) {
+        markOnAdmit = true;
+    }
+
+    void admit(BID, PID) override {}
+    void evicted(BID, PID) override {}
+
+    u64 sweep(u64 want) override {
+        u64 visited = 0;
+        u64 taken = 0;
+        bm.page_table->clock_sweep_next([&](PID pid, BufTagged& buf) {
+            ensure(bm.buffer_frames[buf.id()].pid == pid); // invariant
+            visited++;
+            if (!bm.evictable(buf)) {
+                return false;
+            }
+            if (buf.marked()) {
+                buf.set_marked(false);
+                return false;
+            }
+            bm.takeVictim(buf);
+            return ++taken == want;
+        });
+        return visited;
+    }
+
+    const size_t* tableHand() const override {
+        return &bm.page_table->sweep_;
+    }
+};
+
+
+// SIEVE: FIFO by insertion, the hand moves from the oldest towards the newest
+// frame and frames stay in place when their reference bit is cleared.
+struct SievePolicy : EvictionPolicy {
+    FrameLists links;
+    FrameLists::List queue{.id = 1};
+    u32 hand = FrameLists::kNil;
+
+    explicit SievePolicy(BufferManager& bm) : EvictionPolicy(bm) {
+        links.init(bm.page_count);
+    }
+
+    void admit(BID bid, PID) override {
+        links.pushHead(queue, bid);
+    }
+
+    void evicted(BID bid, PID) override {
+        if (hand == bid) {
+            hand = links.prev[bid];
+        }
+        links.unlink(queue, bid);
+    }
+
+    u64 sweep(u64 want) override {
+        u64 visited = 0;
+        u64 taken = 0;
+        u64 limit = 2 * queue.size; // the first round may only clear reference bits
+        while (taken < want && visited < limit) {
+            u32 b = hand != FrameLists::kNil ? hand : queue.tail;
+            hand = links.prev[b];
+            visited++;
+
+            auto& buf = entry(bm, b);
+            if (!bm.evictable(buf)) {
+                continue;
+            }
+            if (buf.marked()) {
+                buf.set_marked(false);
+                continue;
+            }
+            bm.takeVictim(buf); // unlinked by evicted()
+            taken++;
+        }
+        return visited;
+    }
+};
+
+
+// 2Q: new frames enter the FIFO A1in and are evicted from there unless their
+// PID is found in the ghost list A1out, then they enter the main queue Am
+// (second chance instead of LRU, fixes only set reference bits).
+struct TwoQPolicy : EvictionPolicy {
+    FrameLists links;
+    FrameLists::List in{.id = 1};
+    FrameLists::List am{.id = 2};
+    GhostList out;
+    u64 inTarget;
+
+    explicit TwoQPolicy(BufferManager& bm) : EvictionPolicy(bm) {
+        links.init(bm.page_count);
+        inTarget = bm.page_count / 4;
+        out.capacity = bm.page_count / 2;
+    }
+
+    void admit(BID bid, PID pid) override {
+        links.pushHead(out.erase(pid) ? am : in, bid);
+    }
+
+    void evicted(BID bid, PID pid) override {
+        if (links.contains(in, bid)) {
+            links.unlink(in, bid);
+            out.push(pid);
+        } else {
+            links.unlink(am, bid);
+        }
+    }
+
+    u64 sweep(u64 want) override {
+        u64 visited = 0;
+        u64 taken = 0;
+        u64 limit = 2 * (in.size + am.size);
+        while (taken < want && visited < limit) {
+            bool fromIn = in.size > inTarget || am.size == 0;
+            auto& list = fromIn ? in : am;
+            u32 b = list.tail;
+            links.moveHead(list, list, b); // taken or not, look at the others first
+            visited++;
+
+            auto& buf = entry(bm, b);
+            if (!bm.evictable(buf)) {
+                continue;
+            }
+            if (buf.marked()) {
+                buf.set_marked(false);
+                if (!fromIn) {
+                    continue; // second chance in Am, A1in ignores references
+                }
+            }
+            bm.takeVictim(buf);
+            taken++;
+        }
+        return visited;
+    }
+};
+
+
+// CAR (CLOCK with Adaptive Replacement), ARC with reference bits: T1 holds
+// frames seen once, T2 frames referenced again. The ghost lists B1/B2 move
+// the target size p of T1 towards whichever list would have had the hit.
+struct CarPolicy : EvictionPolicy {
+    FrameLists links;
+    FrameLists::List t1{.id = 1};
+    FrameLists::List t2{.id = 2};
+    GhostList b1;
+    GhostList b2;
+    u64 c;
+    u64 p = 0;
+
+    explicit CarPolicy(BufferManager& bm) : EvictionPolicy(bm) {
+        links.init(bm.page_count);
+        c = bm.page_count;
+        b1.capacity = c;
+        b2.capacity = c;
+    }
+
+    void admit(BID bid, PID pid) override {
+        if (b1.erase(pid)) {
+            p = std::min(p + std::max<u64>(1, b2.size() / std::max<u64>(1, b1.size())), c);
+            links.pushHead(t2, bid);
+            return;
+        }
+        if (b2.erase(pid)) {
+            u64 delta = std::max<u64>(1, b1.size() / std::max<u64>(1, b2.size()));
+            p = p > delta ? p - delta : 0;
+            links.pushHead(t2, bid);
+            return;
+        }
+
+        // directory holds at most c pages seen once and 2c in total
+        if (t1.size + b1.size() >= c) {
+            b1.popOldest();
+        } else if (t1.size + t2.size + b1.size() + b2.size() >= 2 * c) {
+            b2.popOldest();
+        }
+        links.pushHead(t1, bid);
+    }
+
+    void evicted(BID bid, PID pid) override {
+        if (links.contains(t1, bid)) {
+            links.unlink(t1, bid);
+            b1.push(pid);
+        } else {
+            links.unlink(t2, bid);
+            b2.push(pid);
+        }
+    }
+
+    u64 sweep(u64 want) override {
+        u64 visited = 0;
+        u64 taken = 0;
+        u64 limit = 2 * (t1.size + t2.size);
+        while (taken < want && visited < limit) {
+            bool fromT1 = t1.size >= std::max<u64>(1, p) || t2.size == 0;
+            auto& list = fromT1 ? t1 : t2;
+            u32 b = list.tail;
+            visited++;
+
+            auto& buf = entry(bm, b);
+            if (!bm.evictable(buf)) {
+                links.moveHead(list, list, b);
+                continue;
+            }
+            if (buf.marked()) {
+                buf.set_marked(false);
+                links.moveHead(list, t2, b); // referenced again: frequent
+                continue;
+            }
+            links.moveHead(list, list, b);
+            bm.takeVictim(buf);
+            taken++;
+        }
+        return visited;
+    }
+};
+
+} // namespace
+
+
+std::unique_ptr<EvictionPolicy> makeEvictionPolicy(const std::string& name, BufferManager& bm) {
+    if (name == "clock") {
+        return std::make_unique<ClockPolicy>(bm);
+    } else if (name == "sieve") {
+        return std::make_unique<SievePolicy>(bm);
+    } else if (name == "2q") {
+        return std::make_unique<TwoQPolicy>(bm);
+    } else if (name == "arc") {
+        return std::make_unique<CarPolicy>(bm);
+    }
+    ensure(false, "unknown eviction policy");
+    return nullptr;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct BufferManager;
+
+
+// Chooses the frames evict() writes back and frees (--eviction).
+//
+// Every fix sets the kMark reference bit of its page table entry, policies
+// only read and clear it. Frames that cannot be evicted right now (latched,
+// read in, already evicting) are skipped and keep their reference bit.
+struct EvictionPolicy {
+    BufferManager& bm;
+    bool markOnAdmit = false; // the fault counts as a reference, otherwise the faulting fix does not
+
+    explicit EvictionPolicy(BufferManager& bm) : bm(bm) {}
+    virtual ~EvictionPolicy() = default;
+
+    virtual void admit(BID bid, PID pid) = 0;   // frame was filled by allocPage or handleFault
+    virtual void evicted(BID bid, PID pid) = 0; // frame went back to the free list
+
+    // takes up to `want` victims with BufferManager::takeVictim, returns frames visited
+    virtual u64 sweep(u64 want) = 0;
+
+    // page table slot of the clock hand, for policies sweeping the page table
+    virtual const size_t* tableHand() const { return nullptr; }
+};
+
+std::unique_ptr<EvictionPolicy> makeEvictionPolicy(const std::string& name, BufferManager& bm);
+
+
+// intrusive doubly linked lists over frames, every frame is in at most one list
+struct FrameLists {
+    static constexpr u32 kNil = ~0u;
+
+    struct List {
+        u8 id;
+        u32 head = kNil; // most recently inserted
+        u32 tail = kNil;
+        u64 size = 0;
+    };
+
+    std::vector<u32> prev; // towards head
+    std::vector<u32> next; // towards tail
+    std::vector<u8> owner; // List::id, 0 if in none
+
+    void init(u64 frames) {
+        prev.assign(frames, kNil);
+        next.assign(frames, kNil);
+        owner.assign(frames, 0);
+    }
+
+    bool contains(const List& l, u32 b) const { return owner[b] == l.id; }
+
+    void pushHead(List& l, u32 b) {
+        prev[b] = kNil;
+        next[b] = l.head;
+        if (l.head != kNil) {
+            prev[l.head] = b;
+        } else {
+            l.tail = b;
+        }
+        l.head = b;
+        owner[b] = l.id;
+        ++l.size;
+    }
+
+    void unlink(List& l, u32 b) {
+        if (prev[b] != kNil) {
+            next[prev[b]] = next[b];
+        } else {
+            l.head = next[b];
+        }
+        if (next[b] != kNil) {
+            prev[next[b]] = prev[b];
+        } else {
+            l.tail = prev[b];
+        }
+        owner[b] = 0;
+        --l.size;
+    }
+
+    void moveHead(List& from, List& to, u32 b) {
+        unlink(from, b);
+        pushHead(to, b);
+    }
+};
+
+
+// PIDs of recently evicted pages, oldest dropped first
+struct GhostList {
+    u64 capacity = 0;
+    u64 seq = 0;
+    std::deque<std::pair<PID, u64>> fifo; // may hold entries erased by a hit
+    std::unordered_map<PID, u64> live;
+
+    u64 size() const { return live.size(); }
+
+    bool erase(PID pid) { return live.erase(pid); }
+
+    void push(PID pid) {
+        live[pid] = ++seq;
+        fifo.emplace_back(pid, seq);
+        while (live.size() > capacity) {
+            popOldest();
+        }
+        if (fifo.size() > 2 * capacity + 64) {
+            std::erase_if(fifo, [&](auto& e) { auto it = live.find(e.first); return it == live.end() || it->second != e.second; });
+        }
+    }
+
+    void popOldest() {
+        while (!fifo.empty()) {
+            auto [pid, s] = fifo.front();
+            fifo.pop_front();
+            auto it = live.find(pid);
+            if (it != live.end() && it->second == s) {
+                live.erase(it);
+                return;
+            }
+        }
+    }
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "types.hpp"
+#include "utils/my_asserts.hpp"
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+
+// Free buffer frames, replaces a plain free list.
+//
+// Frames move in magazines of `batch` BIDs. Allocations pop from the loaded
+// magazine, freed frames fill another one that goes to the depot once it is
+// full. Full and empty magazines are kept in two stacks (the depot), each
+// shard owns its FreeFrames and only its own fibers touch it. The evictor
+// is woken below the low watermark and keeps going until the high
+// watermark is reached.
+struct FreeFrames {
+    struct Magazine {
+        u32 count = 0;
+        u32 next = kNil; // depot link
+        BID* bids;
+    };
+    static constexpr u32 kNil = ~0u;
+
+    // intrusive list of magazine indices
+    struct Stack {
+        u32 head = kNil;
+
+        void push(std::vector<Magazine>& mags, u32 idx) {
+            mags[idx].next = head;
+            head = idx;
+        }
+
+        u32 pop(std::vector<Magazine>& mags) {
+            u32 idx = head;
+            if (idx != kNil) {
+                head = mags[idx].next;
+            }
+            return idx;
+        }
+    };
+
+    u32 batch = 0;
+    u64 low = 0;
+    u64 high = 0;
+    bool refilling = false;
+    std::function<void()> wake_evictor;
+
+    std::vector<BID> storage;
+    std::vector<Magazine> mags;
+    Stack full;
+    Stack empty;
+    u32 loaded = kNil;  // allocations pop from here
+    u32 filling = kNil; // frees push here
+    u64 count = 0;
+
+    u64 magazineRefills = 0;
+
+    // BIDs [1, frames) are free, 0 holds the metadata page
+    void init(u64 frames, u32 batch_size, double low_target, double high_target) {
+        batch = batch_size;
+        low = frames * low_target;
+        high = frames * high_target;
+        ensure(batch > 0 && high >= low);
+
+        u64 num_mags = (frames + batch - 1) / batch + 2; // + loaded and filling
+        storage.resize(num_mags * batch);
+        mags.resize(num_mags);
+        for (u64 i = 0; i < num_mags; ++i) {
+            mags[i].bids = storage.data() + i * batch;
+        }
+
+        // fill in descending order so allocations give 1,2,...
+        u32 m = 0;
+        for (BID bid = frames - 1; bid >= 1; --bid) {
+            if (mags[m].count == batch) {
+                ++m;
+            }
+            mags[m].bids[mags[m].count++] = bid;
+        }
+        count = frames - 1;
+        for (u32 i = 0; i < num_mags; ++i) {
+            (mags[i].count ? full : empty).push(mags, i); // the one ending with BID 1 on top
+        }
+        loaded = full.pop(mags);
+        filling = empty.pop(mags);
+    }
+
+    u64 size() const {
+        return count;
+    }
+
+    // hysteresis between the watermarks
+    bool needsEviction() {
+        u64 free = size();
+        if (free <= low) {
+            refilling = true;
+        } else if (free >= high) {
+            refilling = false;
+        }
+        return refilling;
+    }
+
+    // false if no frame is left
+    bool alloc(BID& bid) {
+        if (needsEviction()) {
+            wake_evictor();
+        }
+        if (loaded == kNil || mags[loaded].count == 0) [[unlikely]] {
+            if (!reload()) {
+                return false;
+            }
+        }
+        auto& mag = mags[loaded];
+        bid = mag.bids[--mag.count];
+        --count;
+        return true;
+    }
+
+    void free(BID bid) {
+        if (filling == kNil) [[unlikely]] {
+            filling = empty.pop(mags);
+            ensure(filling != kNil);
+        }
+        auto& mag = mags[filling];
+        mag.bids[mag.count++] = bid;
+        ++count;
+        if (mag.count == batch) {
+            full.push(mags, filling);
+            filling = empty.pop(mags);
+        }
+    }
+
+private:
+    bool reload() {
+        u32 next = full.pop(mags);
+        if (next == kNil) {
+            // depot is empty, take the frames freed so far
+            if (filling == kNil || mags[filling].count == 0) {
+                return false;
+            }
+            std::swap(loaded, filling);
+            ++magazineRefills;
+            return true;
+        }
+        if (loaded != kNil) {
+            empty.push(mags, loaded);
+        }
+        loaded = next;
+        ++magazineRefills;
+        return true;
+    }
+};
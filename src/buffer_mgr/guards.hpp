@@ -7,25 +7,33 @@
 #include <cassert>
 
 
+// Optimistic for local pages: no latch is taken, the frame version is checked
+// whenever the guard is left. Pages of other shards are fixed shared.
 template <class T>
 struct GuardS {
     PID pid = moved;
     T* ptr;
+    FrameHandle frame;
+    bool shared = false;
     static const u64 moved = ~0ull;
 
     GuardS() = delete;
 
     // constructor
     explicit GuardS(u64 pid) : pid(pid) {
-        ptr = reinterpret_cast<T*>(bm.fixS(pid));
+        if (bm.isLocal(pid)) {
+            ptr = reinterpret_cast<T*>(bm.fixO(pid, frame));
+        } else {
+            shared = true;
+            ptr = reinterpret_cast<T*>(bm.fixS(pid, &frame));
+        }
     }
 
     GuardS(GuardS&& other) {
-        assert(pid != other.pid);
-        if (pid != moved && ptr)
-            bm.unfixS(pid);
         pid = other.pid;
         ptr = other.ptr;
+        frame = other.frame;
+        shared = other.shared;
         other.pid = moved;
         other.ptr = nullptr;
     }
@@ -33,15 +41,25 @@ struct GuardS {
     // assignment operator
     GuardS& operator=(const GuardS&) = delete;
 
-    // move assignment operator
+    // move assignment operator, fails (retry()) if the released page changed
     GuardS& operator=(GuardS&& other) {
         assert(pid != other.pid);
-        if (pid != moved && ptr)
-            bm.unfixS(pid);
+        bool valid = pid == moved || !ptr || validate();
+        if (pid != moved && ptr && shared)
+            bm.unfixS(pid, frame);
         pid = other.pid;
         ptr = other.ptr;
+        frame = other.frame;
+        shared = other.shared;
         other.pid = moved;
         other.ptr = nullptr;
+        if (!valid && ptr) {
+            // keep restart_ctx of a failed fix, only report our own failure
+            if (shared)
+                bm.unfixS(pid, frame);
+            ptr = nullptr;
+            bm.restartVersion();
+        }
         return *this;
     }
 
@@ -50,8 +68,8 @@ struct GuardS {
 
     // destructor
     ~GuardS() {
-        if (pid != moved && ptr)
-            bm.unfixS(pid);
+        if (pid != moved && ptr && shared)
+            bm.unfixS(pid, frame);
     }
 
     T* operator->() {
@@ -59,11 +77,23 @@ struct GuardS {
         return ptr;
     }
 
-    void release() {
+    // false if what was read through this guard might be inconsistent
+    bool validate() {
+        return shared || bm.validate(frame);
+    }
+
+    bool release() {
+        bool valid = true;
         if (pid != moved && ptr) {
-            bm.unfixS(pid);
+            if (shared) {
+                bm.unfixS(pid, frame);
+            } else if (!bm.validate(frame)) {
+                bm.restartVersion();
+                valid = false;
+            }
             pid = moved;
         }
+        return valid;
     }
 
 
@@ -76,6 +106,7 @@ template <class T>
 struct GuardX {
     PID pid = moved;
     T* ptr;
+    FrameHandle frame;
     static const u64 moved = ~0ull;
 
     // constructor
@@ -83,26 +114,33 @@ struct GuardX {
 
     // constructor
     explicit GuardX(u64 pid) : pid(pid) {
-        ptr = reinterpret_cast<T*>(bm.fixX(pid));
+        ptr = reinterpret_cast<T*>(bm.fixX(pid, &frame));
         // ptr->hdr.dirty = true;
     }
 
 
+    // upgrade, check retry(): fails if the page changed since it was read
     explicit GuardX(GuardS<T>&& other) {
         assert(other.pid != moved);
 
         pid = other.pid;
-        ptr = other.ptr;
-        other.pid = moved;
+        frame = other.frame;
+        if (other.ptr) {
+            ptr = reinterpret_cast<T*>(bm.upgrade(pid, frame));
+        } else {
+            ptr = nullptr;
+        }
+        other.pid = moved; // a remote shared fix is consumed by the upgrade
         other.ptr = nullptr;
     }
 
     GuardX(GuardX&& other) {
         assert(pid != other.pid);
         if (pid != moved && ptr)
-            bm.unfixX(pid);
+            bm.unfixX(pid, frame);
         pid = other.pid;
         ptr = other.ptr;
+        frame = other.frame;
         other.pid = moved;
         other.ptr = nullptr;
     }
@@ -114,10 +152,11 @@ struct GuardX {
     GuardX& operator=(GuardX&& other) {
         assert(pid != other.pid);
         if (pid != moved && ptr) {
-            bm.unfixX(pid);
+            bm.unfixX(pid, frame);
         }
         pid = other.pid;
         ptr = other.ptr;
+        frame = other.frame;
         other.pid = moved;
         other.ptr = nullptr;
         return *this;
@@ -129,7 +168,7 @@ struct GuardX {
     // destructor
     ~GuardX() {
         if (pid != moved && ptr)
-            bm.unfixX(pid);
+            bm.unfixX(pid, frame);
     }
 
     T* operator->() {
@@ -139,7 +178,7 @@ struct GuardX {
 
     void release() {
         if (pid != moved && ptr) {
-            bm.unfixX(pid);
+            bm.unfixX(pid, frame);
             pid = moved;
         }
     }
@@ -153,11 +192,9 @@ template <class T>
 struct AllocGuard : public GuardX<T> {
     template <typename... Params>
     AllocGuard(Params&&... params) {
-        GuardX<T>::ptr = reinterpret_cast<T*>(bm.allocPage());
+        GuardX<T>::ptr = reinterpret_cast<T*>(bm.allocPage(GuardX<T>::pid));
         if (GuardX<T>::ptr) {
             new (GuardX<T>::ptr) T(std::forward<Params>(params)...);
         }
-        // GuardX<T>::pid = bm.toPID(GuardX<T>::ptr);
-        GuardX<T>::pid = bm.allocCount - 1; // TODO make this nicer with allocPage
     }
 };
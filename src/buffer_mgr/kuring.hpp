@@ -2,6 +2,9 @@
 
 #include "exp_table.hpp"
 #include "spsc_ring.hpp"
+#include "stack_pool.hpp"
+#include "steal_queue.hpp"
+#include "submit_batcher.hpp"
 #include "tpcc/random_generator.hpp"
 #include "utils/cpu_map.hpp"
 #include "utils/jmp.hpp"
@@ -15,38 +18,78 @@
 #include <algorithm>
 #include <boost/context/continuation.hpp>
 #include <cassert>
+#include <cmath>
+#include <coroutine>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <libaio.h>
 #include <liburing.h>
 #include <memory>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <utility>
 #include <vector>
 
 namespace ctx = boost::context;
 
-extern u64 write_cycles;
-extern u64 io_cycles;
-extern RDTSCClock write_clock;
+extern thread_local u64 write_cycles;
+extern thread_local u64 io_cycles;
+extern thread_local RDTSCClock write_clock;
 
 
 struct BaseReactor {
     enum class State : uint8_t { Ready,
                                  Running,
                                  Parked,
+                                 Stealable, // ready in stealable_, any reactor may resume it
                                  Finished };
 
     struct Fiber {
         ctx::continuation peer;
+        std::coroutine_handle<> coro; // innermost suspended coroutine of a stackless task, see coro.hpp
         State state = State::Ready;
+        void* local = nullptr; // fiber-local data, e.g. the WAL buffer, owned elsewhere
+        uint64_t resumed = 0;    // with run_timing: when the current slice started
+        uint64_t run_cycles = 0; // and the slices before
     };
 
-    static constexpr size_t MAX_FIBERS = 256;
+    static constexpr jmp::static_branch<bool> run_timing = false; // --tx_latency
+
+    static constexpr size_t EXP_RANGE = 256;
+    static constexpr auto& table = ExpTable<EXP_RANGE>::values;
+
+    // exp(a - b), at most 1, for the random submit policy
+    static double submit_chance(int a, int b) {
+        int d = std::clamp(a - b, -static_cast<int>(EXP_RANGE), 0);
+        return 1.0 / table[-d];
+    }
+
+    StackPool stacks;
+
+
+    // Control blocks are recycled and keep their address while in use
+    Fiber* new_fiber() {
+        if (free_fibers_.empty()) {
+            return &fibers_.emplace_back();
+        }
+        Fiber* f = free_fibers_.back();
+        free_fibers_.pop_back();
+        *f = Fiber{};
+        return f;
+    }
+
+    void delete_fiber(Fiber* f) {
+        f->peer = {}; // unwinds a suspended fiber, its stack goes back to the pool
+        free_fibers_.push_back(f);
+    }
 
 
     template <class Fn>
     inline void spawn(Fiber* f, Fn&& fn) {
         f->peer = ctx::callcc(
+            std::allocator_arg, PooledStack{&stacks},
             [this, f, fncap = std::forward<Fn>(fn)](ctx::continuation&& caller) mutable {
                 // cold start: capture reactor continuation, bounce back
                 f->peer = std::move(caller);
@@ -64,14 +107,26 @@ struct BaseReactor {
     // Fiber-side API
     inline void yield() {
         assert(fiber_current_ && "yield() outside fiber");
+        assert(!fiber_current_->coro && "tasks co_await mini::co::yield()");
         Fiber* f = fiber_current_;
         f->state = State::Ready;
         ensure(ready_.push(f));                // enqueue self now
         f->peer = std::move(f->peer).resume(); // hop to reactor
     }
 
+    // yield() at a point where the fiber holds no reactor-local state (no
+    // pending I/O, fixes or log buffer), so a neighbour may resume it
+    inline void yield_stealable() {
+        assert(fiber_current_ && "yield_stealable() outside fiber");
+        assert(!fiber_current_->coro && "tasks cannot migrate");
+        Fiber* f = fiber_current_;
+        f->state = State::Stealable; // published by resume() once it is off this stack
+        f->peer = std::move(f->peer).resume();
+    }
+
     inline void park() {
         assert(fiber_current_ && "park() outside fiber");
+        assert(!fiber_current_->coro && "tasks co_await mini::co::park()");
         Fiber* f = fiber_current_;
         f->state = State::Parked;
         f->peer = std::move(f->peer).resume();
@@ -94,10 +149,226 @@ struct BaseReactor {
         return fiber_current_;
     }
 
+    // cycles the current fiber spent running so far, needs run_timing
+    inline uint64_t run_cycles() const noexcept {
+        return fiber_current_->run_cycles + (RDTSCClock::read() - fiber_current_->resumed);
+    }
+
+
+    // Stackless tasks run on a control block without stack and suspend by
+    // returning to the reactor, which resumes them through Fiber::coro.
+    inline void spawn_task(Fiber* f, std::coroutine_handle<> h) {
+        f->coro = h;
+        ensure(ready_.push(f));
+    }
+
+    inline void park_task(std::coroutine_handle<> h) {
+        assert(fiber_current_ && fiber_current_->coro && "park_task() outside task");
+        fiber_current_->coro = h;
+        fiber_current_->state = State::Parked;
+    }
+
+    inline void yield_task(std::coroutine_handle<> h) {
+        assert(fiber_current_ && fiber_current_->coro && "yield_task() outside task");
+        Fiber* f = fiber_current_;
+        f->coro = h;
+        f->state = State::Ready;
+        ensure(ready_.push(f));
+    }
+
 
 protected:
+    inline void resume(Fiber* f) {
+        if (run_timing) {
+            f->resumed = RDTSCClock::read();
+        }
+        if (f->coro) {
+            fiber_current_ = f;
+            f->state = State::Running;
+            f->coro.resume();
+        } else {
+            f->peer = std::move(f->peer).resume_with([this, f](ctx::continuation&& back) noexcept {
+                fiber_current_ = f;
+                f->state = State::Running;
+                return std::move(back);
+            });
+        }
+        fiber_current_ = nullptr;
+        if (run_timing) {
+            f->run_cycles += RDTSCClock::read() - f->resumed;
+        }
+        if (f->state == State::Stealable) {
+            ensure(stealable_.push(f));
+        }
+    }
+
+public:
+    // Work stealing between the reactors of all shards (--steal). Fibers
+    // that yield_stealable() go to stealable_ instead of ready_. A reactor
+    // runs its own first and takes one from the neighbour with the longest
+    // queue when every fiber of its own is parked on I/O. A stolen fiber
+    // keeps running on the thief, its I/O is submitted to and completes on
+    // the thief's ring; fixes of pages owned by another shard are forwarded
+    // with MSG_RING as usual.
+    static constexpr size_t kStealMin = 2; // leave the victim one to run
+
+    std::vector<BaseReactor*> neighbours;
+    uint64_t steals = 0;
+
+    void init_stealing(size_t fibers) {
+        stealable_.init(fibers);
+    }
+
+    // returns the number of fibers resumed
+    size_t run_stealable() {
+        Fiber* f;
+        size_t n = stealable_.size();
+        if (n == 0 && ready_.empty()) {
+            if (!steal(f)) {
+                return 0;
+            }
+            resume(f);
+            return 1;
+        }
+        size_t i = 0;
+        for (; i < n && stealable_.pop(f); ++i) { // thieves may have taken some
+            resume(f);
+        }
+        return i;
+    }
+
+    // Minimal scheduler: resume until ring is empty. No requeue here.
+    // The reactors share it, R brings the ring: submit(), drain_cqe(), the
+    // adaptive batcher and its static branches.
+    template <class R>
+    static void run_loop(R& r, bool& stop) {
+        while (!stop) {
+            Fiber* f;
+            size_t n = r.ready_.size();
+            for (size_t i = 0; i < n; ++i) {
+                ensure(r.ready_.pop(f));
+                r.resume(f);
+                r.fiber_run++;
+            }
+            if (R::work_stealing) {
+                r.fiber_run += r.run_stealable();
+            }
+            if (R::submit_adaptive && r.to_submit > 0 && r.batcher.expired()) {
+                r.batcher.submitting(r.to_submit, true);
+                r.submit();
+            }
+            r.drain_cqe();
+        }
+    }
+
+    // Queueing and the submit policy are shared as well, R only brings how a
+    // request gets into its queue (add_io()) and submit().
+    template <class R, class Prep>
+    static void queue_one(R& r, typename R::Op& op, Prep&& prep) {
+        op.ctx = r.current();
+        op.res = 0;
+        op.total = 0;
+        op.flags = 0;
+
+        r.add_io(op, prep);
+
+        r.outstanding_io += op.cqe_left;
+        r.to_submit++;
+        if (R::submit_adaptive) {
+            op.queued = r.batcher.queued(r.to_submit);
+        }
+        r.check_submit();
+    }
+
+    template <class R, class Prep>
+    static void queue_batch(R& r, int n, typename R::Op& op, Prep&& prep) {
+        ensure(n > 0);
+
+        op.ctx = r.current();
+        op.res = 0;
+        op.total = 0;
+        op.flags = 0;
+        op.cqe_left = n;
+
+        for (int i = 0; i < n; ++i) {
+            r.add_io(op, [&](auto* req) { prep(i, req); });
+        }
+
+        r.outstanding_io += op.cqe_left;
+        r.submit();
+        if (op.submit_clock) {
+            op.submit_clock->stop();
+        }
+    }
+
+    // Always inlined, as is check_submit(): an out-of-line copy in several TUs
+    // leaves __jmp entries of the static branches pointing into the copies the
+    // linker discards (without LTO).
+    template <class R>
+    [[gnu::always_inline]] static void submit_policy(R& r) {
+        if (r.to_submit == 0) {
+            return;
+        }
+
+        if (R::submit_always) {
+            r.submit();
+            return;
+        }
+
+        r.fibers_since_first_io++;
+
+        bool do_submit = false;
+        if (r.fibers_since_first_io == r.total_io_fibers) {
+            do_submit = true;
+        }
+
+        if (R::submit_adaptive) {
+            if (do_submit || r.batcher.due(r.to_submit)) {
+                r.batcher.submitting(r.to_submit, !do_submit && static_cast<uint32_t>(r.to_submit) < r.batcher.target);
+                r.submit();
+            }
+            return;
+        }
+
+        if (!do_submit) {
+            // int submit_prob = 1'000'000 / ((to_submit + 1) * 4);
+            // int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(2));
+            // int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(total_io_fibers / 2));
+            int submit_prob = 1'000'000 * submit_chance(r.fibers_since_first_io - r.to_submit, r.total_io_fibers / 4);
+            u64 rnd = RandomGenerator::getRand(0, 1'000'000);
+            if (rnd <= static_cast<u64>(submit_prob)) {
+                do_submit = true;
+            }
+        }
+
+        if (do_submit) {
+            r.submit();
+        }
+    }
+
+protected:
+    bool steal(Fiber*& f) {
+        BaseReactor* victim = nullptr;
+        size_t longest = kStealMin - 1;
+        for (auto* r : neighbours) {
+            size_t len = r->stealable_.size();
+            if (len > longest) {
+                victim = r;
+                longest = len;
+            }
+        }
+        if (!victim || !victim->stealable_.pop(f)) {
+            return false;
+        }
+        ++steals;
+        return true;
+    }
+
     Fiber* fiber_current_ = nullptr; // valid only while inside a fiber
-    SpscRing<Fiber*, MAX_FIBERS> ready_;
+    GrowableRing<Fiber*> ready_;
+    StealQueue<Fiber*> stealable_;
+    std::deque<Fiber> fibers_;
+    std::vector<Fiber*> free_fibers_;
 };
 
 
@@ -107,23 +378,8 @@ struct UringReactor : BaseReactor {
     uint64_t get_events = 0;
 
 
-    // Minimal scheduler: resume until ring is empty. No requeue here.
     void run(bool& stop) {
-        while (!stop) {
-            Fiber* f;
-            size_t n = ready_.size();
-            for (int i = 0; i < n; ++i) {
-                ensure(ready_.pop(f));
-                f->peer = std::move(f->peer).resume_with([this, f](ctx::continuation&& back) noexcept {
-                    fiber_current_ = f;
-                    f->state = State::Running;
-                    return std::move(back);
-                });
-                fiber_current_ = nullptr;
-                fiber_run++;
-            }
-            drain_cqe();
-        }
+        run_loop(*this, stop);
     }
 
 
@@ -134,8 +390,11 @@ struct UringReactor : BaseReactor {
 
         // for batching
         int cqe_left = 1;
+        int64_t total = 0;                  // sum of cqe->res, a batch was complete iff it matches the summed lengths
+        RDTSCClock* submit_clock = nullptr; // stopped once the batch is submitted
         // for fibers waiting on this completion
         Op* next = nullptr;
+        uint64_t queued = 0; // rdtsc, only with adaptive batching
     };
 
     struct io_uring& ring_;
@@ -145,131 +404,91 @@ struct UringReactor : BaseReactor {
     int fibers_since_first_io = 0;
     uint64_t num_submits = 0;
 
-    UringReactor(struct io_uring& ring) : ring_(ring) {}
+    // Messages posted by other rings (IORING_OP_MSG_RING) are tagged in the
+    // low bit of their user_data; all Op* are at least 8-byte aligned.
+    static constexpr uint64_t kMsgTag = 1;
+    using MsgHandler = void (*)(uint64_t data, int res);
+    MsgHandler on_msg = nullptr; // set when other rings may post to us
+    uint64_t msgs_received = 0;
 
+    UringReactor(struct io_uring& ring) : ring_(ring) {}
 
-    template <class Prep>
-    inline int io(Op& op, Prep&& prep) {
-        // RDTSCClock clock(2.4_GHz);
-        // clock.start();
-
-        op.ctx = current();
-        op.res = 0;
-        op.flags = 0;
 
+    // Post a CQE with user_data=data and res=res to another ring. Our own
+    // CQE is skipped on success, so this does not count as outstanding I/O.
+    void send_msg(int ring_fd, uint64_t data, int res) {
         struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
         check_ptr(sqe);
-        prep(sqe);
-        io_uring_sqe_set_data(sqe, &op);
-
-        // io_uring_submit(&ring_);
-        outstanding_io += op.cqe_left;
+        prep_msg(sqe, ring_fd, data, res);
+        io_uring_sqe_set_data(sqe, nullptr);
         to_submit++;
-        check_submit();
+        if (submit_adaptive) {
+            batcher.queued(to_submit);
+        }
+    }
 
-        // clock.stop();
-        // io_cycles += clock.cycles();
+    static void prep_msg(struct io_uring_sqe* sqe, int ring_fd, uint64_t data, int res) {
+        io_uring_prep_msg_ring(sqe, ring_fd, res, data, 0);
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    }
 
-        park();
+    void submit() {
+        io_uring_submit(&ring_);
+        ++num_submits;
+        to_submit = 0;
+        fibers_since_first_io = 0;
+    }
 
+
+    template <class Prep>
+    inline int io(Op& op, Prep&& prep) {
+        queue_io(op, std::forward<Prep>(prep));
+        park();
         return op.res;
     }
 
-
     template <class Prep>
     int io_batch(int n, Op& op, Prep&& prep) {
-        ensure(n > 0);
-
-        // RDTSCClock clock(2.4_GHz);
-        // clock.start();
-
-        op.ctx = current();
-        op.res = 0;
-        op.flags = 0;
-        op.cqe_left = n;
-
-        // RDTSCClock clock(2.4_GHz);
-        // clock.start();
-
-        for (int i = 0; i < n; ++i) {
-            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
-            check_ptr(sqe);
-            prep(i, sqe);
-            io_uring_sqe_set_data(sqe, &op);
-        }
-
-        // io_uring_submit_and_wait(&ring_, n);
-        outstanding_io += op.cqe_left;
-        io_uring_submit(&ring_);
-        if constexpr (WRITE_RESETS) {
-            ++num_submits;
-            to_submit = 0; // Reset
-            fibers_since_first_io = 0;
-        }
-        write_clock.stop();
-        write_cycles += write_clock.cycles();
-
-        // clock.stop();
-        // io_cycles += clock.cycles();
-
+        queue_io_batch(n, op, std::forward<Prep>(prep));
         park();
-
         return op.res;
     }
 
-    static constexpr auto& table = ExpTable<MAX_FIBERS>::values;
-
-    static constexpr bool WRITE_RESETS = true;
-
-    static constexpr jmp::static_branch<bool> submit_always = false;
-
-
-    void check_submit() {
-        if (to_submit == 0) {
-            return;
-        }
-
-        // if constexpr (ALWAYS_SUBMIT) {
-        if (submit_always) {
-            io_uring_submit(&ring_);
-            to_submit = 0;
-            ++num_submits;
-            return;
-        }
-
-        if (to_submit > 0) {
-            fibers_since_first_io++;
-        }
+    // io() and io_batch() without parking, coroutine tasks suspend themselves
+    template <class Prep>
+    inline void queue_io(Op& op, Prep&& prep) {
+        queue_one(*this, op, std::forward<Prep>(prep));
+    }
 
-        bool do_submit = false;
-        if (fibers_since_first_io == total_io_fibers) {
-            // Logger::info("first submit to_submit=", to_submit);
-            do_submit = true;
-        }
+    template <class Prep>
+    void queue_io_batch(int n, Op& op, Prep&& prep) {
+        queue_batch(*this, n, op, std::forward<Prep>(prep));
+    }
 
-        if (!do_submit) {
-            // int submit_prob = 1'000'000 / ((to_submit + 1) * 4);
-            // int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(2));
-            // int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(total_io_fibers / 2));
-            int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(total_io_fibers / 4));
-            u64 rnd = RandomGenerator::getRand(0, 1'000'000);
-            if (rnd <= submit_prob) {
-                // Logger::info("submit batch=", to_submit);
-                do_submit = true;
-            }
-        }
+    [[gnu::always_inline]] void check_submit() {
+        submit_policy(*this);
+    }
 
-        if (do_submit) {
-            io_uring_submit(&ring_);
-            ++num_submits;
-            to_submit = 0;
-            fibers_since_first_io = 0;
+    template <class Prep>
+    inline void add_io(Op& op, Prep&& prep) {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        if (!sqe) [[unlikely]] { // more fibers with pending I/O than SQ entries
+            submit();
+            sqe = io_uring_get_sqe(&ring_);
         }
+        check_ptr(sqe);
+        prep(sqe);
+        io_uring_sqe_set_data(sqe, &op);
     }
 
+    static constexpr jmp::static_branch<bool> submit_always = false;
+    static constexpr jmp::static_branch<bool> submit_adaptive = false; // --submit_policy=adaptive
+    static constexpr jmp::static_branch<bool> work_stealing = false;   // --steal
+    SubmitBatcher batcher;
+
 
     void drain_cqe() {
-        if (outstanding_io == 0) {
+        if (outstanding_io == 0 && !on_msg) {
             return;
         }
 
@@ -280,16 +499,27 @@ struct UringReactor : BaseReactor {
         io_uring_get_events(&ring_);
 
         int i = 0;
+        int msgs = 0;
         uint32_t head;
         struct io_uring_cqe* cqe;
         io_uring_for_each_cqe(&ring_, head, cqe) {
             ++i;
             check_iou(cqe->res);
 
+            if (cqe->user_data & kMsgTag) {
+                ++msgs;
+                on_msg(cqe->user_data & ~kMsgTag, cqe->res);
+                continue;
+            }
+
             auto* op = static_cast<Op*>(io_uring_cqe_get_data(cqe));
             ensure(op != nullptr);
+            if (submit_adaptive) {
+                batcher.completed(op->queued);
+            }
             if (op && op->ctx) {
                 op->res = cqe->res;
+                op->total += cqe->res;
                 op->flags = cqe->flags;
                 if (--op->cqe_left == 0) {
                     wake(op->ctx); // enqueue the fiber
@@ -297,7 +527,8 @@ struct UringReactor : BaseReactor {
             }
         }
         io_uring_cq_advance(&ring_, i);
-        outstanding_io -= i;
+        outstanding_io -= i - msgs;
+        msgs_received += msgs;
 
         get_events++;
         if (i == 0) {
@@ -311,23 +542,8 @@ struct LibaioReactor : BaseReactor {
     uint64_t fiber_run = 0;
     uint64_t get_events = 0;
 
-    // Minimal scheduler: resume until ring is empty. No requeue here.
     void run(bool& stop) {
-        while (!stop) {
-            Fiber* f;
-            size_t n = ready_.size();
-            for (int i = 0; i < n; ++i) {
-                ensure(ready_.pop(f));
-                f->peer = std::move(f->peer).resume_with([this, f](ctx::continuation&& back) noexcept {
-                    fiber_current_ = f;
-                    f->state = State::Running;
-                    return std::move(back);
-                });
-                fiber_current_ = nullptr;
-                fiber_run++;
-            }
-            drain_cqe();
-        }
+        run_loop(*this, stop);
     }
 
 
@@ -338,8 +554,11 @@ struct LibaioReactor : BaseReactor {
 
         // for batching
         int cqe_left = 1;
+        int64_t total = 0;                  // sum of cqe->res, a batch was complete iff it matches the summed lengths
+        RDTSCClock* submit_clock = nullptr; // stopped once the batch is submitted
         // for fibers waiting on this completion
         Op* next = nullptr;
+        uint64_t queued = 0; // rdtsc, only with adaptive batching
     };
 
     static constexpr int maxIOs = 1024;
@@ -366,166 +585,358 @@ struct LibaioReactor : BaseReactor {
         }
     }
 
+    void submit() {
+        int ret = io_submit(ctx, batch.size(), batch.data());
+        ensure(static_cast<size_t>(ret) == batch.size());
+        batch.clear();
+        ++num_submits;
+        to_submit = 0;
+        fibers_since_first_io = 0;
+    }
+
 
     template <class Prep>
     inline int io(Op& op, Prep&& prep) {
-        // RDTSCClock clock(2.4_GHz);
-        // clock.start();
+        queue_io(op, std::forward<Prep>(prep));
+        park();
+        return op.res;
+    }
 
-        op.ctx = current();
-        op.res = 0;
-        op.flags = 0;
+    template <class Prep>
+    int io_batch(int n, Op& op, Prep&& prep) {
+        queue_io_batch(n, op, std::forward<Prep>(prep));
+        park();
+        return op.res;
+    }
+
+    // io() and io_batch() without parking, coroutine tasks suspend themselves
+    template <class Prep>
+    inline void queue_io(Op& op, Prep&& prep) {
+        queue_one(*this, op, std::forward<Prep>(prep));
+    }
 
+    template <class Prep>
+    void queue_io_batch(int n, Op& op, Prep&& prep) {
+        queue_batch(*this, n, op, std::forward<Prep>(prep));
+    }
+
+    [[gnu::always_inline]] void check_submit() {
+        submit_policy(*this);
+    }
+
+    template <class Prep>
+    inline void add_io(Op& op, Prep&& prep) {
         iocb* cb = free_cbs.pop();
         prep(cb);
-        // io_prep_pwrite(cb + i, blockfd, &virtMem[pid], pageSize, pageSize * pid);
         cb->data = &op;
         batch.push_back(cb);
+    }
 
-        outstanding_io += op.cqe_left;
-        to_submit++;
-        check_submit();
+    static constexpr jmp::static_branch<bool> submit_always = false;
+    static constexpr jmp::static_branch<bool> submit_adaptive = false; // --submit_policy=adaptive
+    static constexpr jmp::static_branch<bool> work_stealing = false;   // --steal
+    SubmitBatcher batcher;
 
-        // clock.stop();
-        // io_cycles += clock.cycles();
 
-        park();
+    void drain_cqe() {
+        if (outstanding_io == 0) {
+            return;
+        }
 
-        return op.res;
+        int ret = io_getevents(ctx, 0, maxIOs, events, nullptr);
+        for (int i = 0; i < ret; ++i) {
+            auto& event = events[i];
+            auto* op = static_cast<Op*>(event.data);
+            check_ret(event.res);
+            if (submit_adaptive) {
+                batcher.completed(op->queued);
+            }
+            if (op && op->ctx) {
+                op->res = event.res;
+                op->total += event.res;
+                op->flags = 0;
+                if (--op->cqe_left == 0) {
+                    wake(op->ctx); // enqueue the fiber
+                }
+            }
+            free_cbs.push(event.obj);
+        }
+        outstanding_io -= ret;
+
+        get_events++;
     }
+};
 
 
-    template <class Prep>
-    int io_batch(int n, Op& op, Prep&& prep) {
-        ensure(n > 0);
+// Simulated SSD for measuring the CPU cost of the buffer manager without a
+// device (buffer_mgr_sim build). Reads and writes are prepared exactly like
+// for io_uring, but served from a DRAM disk per fd and completed once their
+// latency (set_latency) has passed, pending completions sit in a timer wheel
+// with 1us slots. Everything else, i.e. messages between shards, still goes
+// through the ring.
+struct SimReactor : UringReactor {
+    enum class Latency : uint8_t { Fixed,
+                                   Uniform, // [0, 2 * mean]
+                                   Exp };
+
+    struct SimIO {
+        Op* op;
+        uint8_t opcode;
+        int fd;
+        uint64_t addr; // buffer or iovec array
+        uint32_t len;  // bytes or iovecs
+        uint64_t off;
+        uint64_t due; // tick
+        bool link;    // IOSQE_IO_LINK, the next one starts when this one completed
+    };
 
-        // RDTSCClock clock(2.4_GHz);
-        // clock.start();
+    static constexpr uint64_t kSlots = 4096; // power of two
+    static constexpr uint64_t kTickCycles = 2.4_GHz / 1'000'000;
 
-        op.ctx = current();
-        op.res = 0;
-        op.flags = 0;
-        op.cqe_left = n;
+    struct Disk {
+        uint8_t* mem = nullptr;
+        uint64_t size = 0;
+    };
+    uint64_t disk_size = 0; // bytes per simulated fd unless set by size_disk(), reserved lazily
+    std::vector<Disk> disks;
 
-        // RDTSCClock clock(2.4_GHz);
-        // clock.start();
+    Latency dist = Latency::Fixed;
+    uint64_t read_ticks = 0;
+    uint64_t write_ticks = 0;
 
-        for (int i = 0; i < n; ++i) {
-            iocb* cb = free_cbs.pop();
-            prep(i, cb);
-            cb->data = &op;
-            batch.push_back(cb);
+    std::vector<SimIO> pending; // prepared, not yet submitted
+    std::vector<std::vector<SimIO>> wheel;
+    uint64_t wheel_tick;
+    uint64_t sim_ios = 0;
+
+    SimReactor(struct io_uring& ring) : UringReactor(ring), wheel(kSlots) {
+        wheel_tick = now();
+    }
+
+    ~SimReactor() {
+        for (auto& disk : disks) {
+            if (disk.mem) {
+                munmap(disk.mem, disk.size);
+            }
         }
+    }
 
-        // io_uring_submit_and_wait(&ring_, n);
-        outstanding_io += op.cqe_left;
-        int ret = io_submit(ctx, batch.size(), batch.data());
-        ensure(ret == batch.size());
-        batch.clear();
-        if constexpr (WRITE_RESETS) {
-            ++num_submits;
-            to_submit = 0; // Reset
-            fibers_since_first_io = 0;
+    // before the first I/O on fd
+    void size_disk(int fd, uint64_t size) {
+        if (fd >= static_cast<int>(disks.size())) {
+            disks.resize(fd + 1);
         }
-        write_clock.stop();
-        write_cycles += write_clock.cycles();
+        ensure(!disks[fd].mem);
+        disks[fd].size = size;
+    }
 
-        // clock.stop();
-        // io_cycles += clock.cycles();
+    void set_latency(Latency d, uint64_t read_us, uint64_t write_us) {
+        dist = d;
+        read_ticks = read_us;
+        write_ticks = write_us;
+    }
 
+    void run(bool& stop) {
+        run_loop(*this, stop);
+    }
+
+
+    template <class Prep>
+    inline int io(Op& op, Prep&& prep) {
+        queue_io(op, std::forward<Prep>(prep));
         park();
+        return op.res;
+    }
 
+    template <class Prep>
+    int io_batch(int n, Op& op, Prep&& prep) {
+        queue_io_batch(n, op, std::forward<Prep>(prep));
+        park();
         return op.res;
     }
 
-    static constexpr auto& table = ExpTable<MAX_FIBERS>::values;
+    // io() and io_batch() without parking, coroutine tasks suspend themselves
+    template <class Prep>
+    inline void queue_io(Op& op, Prep&& prep) {
+        queue_one(*this, op, std::forward<Prep>(prep));
+    }
 
-    static constexpr bool WRITE_RESETS = true;
+    template <class Prep>
+    void queue_io_batch(int n, Op& op, Prep&& prep) {
+        queue_batch(*this, n, op, std::forward<Prep>(prep));
+    }
 
-    static constexpr jmp::static_branch<bool> submit_always = false;
+    [[gnu::always_inline]] void check_submit() {
+        submit_policy(*this);
+    }
 
+    template <class Prep>
+    inline void add_io(Op& op, Prep&& prep) {
+        struct io_uring_sqe sqe = {};
+        prep(&sqe);
+        queue(op, sqe);
+    }
 
-    void check_submit() {
-        if (to_submit == 0) {
-            return;
+    // the device sees requests only once they are submitted, linked ones
+    // only once their predecessor completed
+    void submit() {
+        uint64_t tick = now();
+        bool linked = false;
+        uint64_t prev_due = 0;
+        for (auto& io : pending) {
+            io.due = (linked ? prev_due : tick) + latency(io.opcode);
+            wheel[io.due & (kSlots - 1)].push_back(io);
+            linked = io.link;
+            prev_due = io.due;
         }
+        pending.clear();
+        UringReactor::submit(); // messages, no syscall if there are none
+    }
 
-        // if constexpr (ALWAYS_SUBMIT) {
-        if (submit_always) {
-            int ret = io_submit(ctx, batch.size(), batch.data());
-            ensure(ret == batch.size());
-            batch.clear();
-            to_submit = 0;
-            ++num_submits;
+
+    void drain_cqe() {
+        if (on_msg) {
+            UringReactor::drain_cqe();
+        }
+        if (sim_ios == 0) {
             return;
         }
 
-        if (to_submit > 0) {
-            fibers_since_first_io++;
+        // the current slot is visited again, it may still get due entries
+        uint64_t tick = now();
+        uint64_t slots = std::min(tick - wheel_tick + 1, kSlots);
+        for (uint64_t t = tick - slots + 1; t <= tick; ++t) {
+            auto& slot = wheel[t & (kSlots - 1)];
+            for (size_t i = 0; i < slot.size();) {
+                if (slot[i].due > tick) {
+                    ++i; // later round
+                    continue;
+                }
+                complete(slot[i]);
+                slot[i] = slot.back();
+                slot.pop_back();
+            }
         }
+        wheel_tick = tick;
+        get_events++;
+    }
 
-        bool do_submit = false;
-        if (fibers_since_first_io == total_io_fibers) {
-            // Logger::info("first submit to_submit=", to_submit);
-            do_submit = true;
-        }
+private:
+    static uint64_t now() {
+        return RDTSCClock::read() / kTickCycles;
+    }
 
-        if (!do_submit) {
-            // int submit_prob = 1'000'000 / ((to_submit + 1) * 4);
-            // int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(2));
-            // int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(total_io_fibers / 2));
-            int submit_prob = 1'000'000 * (table.at(fibers_since_first_io - to_submit) / table.at(total_io_fibers / 4));
-            u64 rnd = RandomGenerator::getRand(0, 1'000'000);
-            if (rnd <= submit_prob) {
-                // Logger::info("submit batch=", to_submit);
-                do_submit = true;
+    uint64_t latency(uint8_t opcode) {
+        uint64_t mean = opcode == IORING_OP_READ || opcode == IORING_OP_READV || opcode == IORING_OP_READ_FIXED
+                            ? read_ticks
+                            : write_ticks;
+        switch (dist) {
+            case Latency::Fixed:
+                return mean;
+            case Latency::Uniform:
+                return RandomGenerator::getRand<uint64_t>(0, 2 * mean + 1);
+            case Latency::Exp: {
+                double u = RandomGenerator::getRand<uint64_t>(1, 1'000'001) / 1'000'001.0;
+                return static_cast<uint64_t>(-std::log(u) * mean);
             }
         }
+        return mean;
+    }
 
-        if (do_submit) {
-            int ret = io_submit(ctx, batch.size(), batch.data());
-            ensure(ret == batch.size());
-            batch.clear();
-            ++num_submits;
-            to_submit = 0;
-            fibers_since_first_io = 0;
+    void queue(Op& op, const struct io_uring_sqe& sqe) {
+        switch (sqe.opcode) {
+            case IORING_OP_READ:
+            case IORING_OP_READV:
+            case IORING_OP_READ_FIXED:
+            case IORING_OP_WRITE:
+            case IORING_OP_WRITEV:
+            case IORING_OP_WRITE_FIXED:
+            case IORING_OP_FSYNC:
+                ensure(!(sqe.flags & IOSQE_FIXED_FILE) && sqe.fd >= 0, "simulated I/O needs plain fds");
+                pending.push_back({&op, sqe.opcode, sqe.fd, sqe.addr, sqe.len, sqe.off, 0, (sqe.flags & IOSQE_IO_LINK) != 0});
+                ++sim_ios;
+                return;
+            default: {
+                struct io_uring_sqe* real = io_uring_get_sqe(&ring_);
+                check_ptr(real);
+                *real = sqe;
+                io_uring_sqe_set_data(real, &op);
+                return;
+            }
         }
     }
 
-
-    void drain_cqe() {
-        if (outstanding_io == 0) {
-            return;
+    Disk& disk(int fd) {
+        if (fd >= static_cast<int>(disks.size())) {
+            disks.resize(fd + 1);
+        }
+        auto& disk = disks[fd];
+        if (!disk.mem) {
+            if (disk.size == 0) {
+                disk.size = disk_size;
+            }
+            // untouched pages read as zeros and cost no memory
+            void* mem = mmap(nullptr, disk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            ensure(mem != MAP_FAILED, "cannot reserve the simulated disk, lower --sim_disk_size");
+            disk.mem = static_cast<uint8_t*>(mem);
         }
+        return disk;
+    }
 
-        int ret = io_getevents(ctx, 0, maxIOs, events, nullptr);
-        for (int i = 0; i < ret; ++i) {
-            auto& event = events[i];
-            auto* op = static_cast<Op*>(event.data);
-            check_ret(event.res);
-            if (op && op->ctx) {
-                op->res = event.res;
-                op->flags = 0;
-                if (--op->cqe_left == 0) {
-                    wake(op->ctx); // enqueue the fiber
-                }
+    void complete(const SimIO& io) {
+        auto& d = disk(io.fd);
+        uint8_t* base = d.mem + io.off;
+        bool read = io.opcode == IORING_OP_READ || io.opcode == IORING_OP_READV || io.opcode == IORING_OP_READ_FIXED;
+
+        auto copy = [&](void* buf, size_t len, size_t pos) {
+            ensure(io.off + pos + len <= d.size, "simulated I/O beyond the disk size");
+            if (read) {
+                std::memcpy(buf, base + pos, len);
+            } else {
+                std::memcpy(base + pos, buf, len);
             }
-            free_cbs.push(event.obj);
+        };
+
+        int res = 0;
+        if (io.opcode == IORING_OP_READV || io.opcode == IORING_OP_WRITEV) {
+            auto* iov = reinterpret_cast<const struct iovec*>(io.addr);
+            for (uint32_t i = 0; i < io.len; ++i) {
+                copy(iov[i].iov_base, iov[i].iov_len, res);
+                res += iov[i].iov_len;
+            }
+        } else if (io.opcode != IORING_OP_FSYNC) {
+            copy(reinterpret_cast<void*>(io.addr), io.len, 0);
+            res = io.len;
         }
-        outstanding_io -= ret;
 
-        get_events++;
+        Op* op = io.op;
+        if (submit_adaptive) {
+            batcher.completed(op->queued);
+        }
+        op->res = res;
+        op->total += res;
+        op->flags = 0;
+        if (--op->cqe_left == 0) {
+            wake(op->ctx);
+        }
+        --outstanding_io;
+        --sim_ios;
     }
 };
 
 
+#ifdef BM_SIM
+using Reactor = SimReactor;
+#else
 using Reactor = UringReactor;
 // using Reactor = LibaioReactor;
+#endif
 
 
 namespace mini {
 
 static constexpr bool LIBAIO = std::is_same_v<Reactor, LibaioReactor>;
+static constexpr bool SIM = std::is_same_v<Reactor, SimReactor>;
 
 
 inline thread_local Reactor* R = nullptr;
@@ -535,9 +946,18 @@ inline void set_reactor(Reactor& r) {
 inline Reactor::Fiber* current() {
     return R->current();
 }
+
+inline uint64_t run_cycles() {
+    return R->run_cycles();
+}
 inline void yield() {
     R->yield();
 }
+// out of line: the caller may continue on another thread, it must not have
+// cached thread_local addresses (bm, wal, R) across this call
+[[gnu::noinline]] inline void yield_stealable() {
+    R->yield_stealable();
+}
 inline void park() {
     R->park();
 }
@@ -572,7 +992,7 @@ struct Fiber {
     template <class Fn, class... Args>
     Fiber(Fn&& fn, Args&&... args) {
         ensure(R, "mini::set_reactor(r) must be called before constructing mini::Fiber");
-        fiber = std::make_unique<Reactor::Fiber>();
+        fiber = std::unique_ptr<Reactor::Fiber, Release>(R->new_fiber(), Release{R});
         Reactor::Fiber* self = fiber.get();
 
         // bind args (perfect-forwarded) and pass to reactor as a zero-arg callable
@@ -586,7 +1006,11 @@ struct Fiber {
     }
 
 private:
-    std::unique_ptr<Reactor::Fiber> fiber;
+    struct Release {
+        Reactor* r;
+        void operator()(Reactor::Fiber* f) const { r->delete_fiber(f); }
+    };
+    std::unique_ptr<Reactor::Fiber, Release> fiber;
 
     // helper: invoke fn either as fn(Fiber*, args...) or fn(args...)
     template <class Fn, class Tup, std::size_t... I>
@@ -19,7 +19,7 @@ struct RHBSU64Map {
     };
     static_assert(sizeof(Value) <= sizeof(uint64_t));
 
-    explicit RHBSU64Map(size_t capacity_pow2)
+    explicit RHBSU64Map(size_t capacity_pow2, int numa_node = -1)
         : n(capacity_pow2), mask(capacity_pow2 - 1) {
         if (n == 0 || (n & (n - 1)))
             throw std::invalid_argument("capacity must be power of two");
@@ -29,8 +29,8 @@ struct RHBSU64Map {
         // ctrl = new uint8_t[n]; // probe distance: 0=empty, 1..254 distance
         // std::memset(ctrl, 0, n);
 
-        entries = HugePages::malloc_array<Entry>(n);
-        ctrl = HugePages::malloc_array<uint8_t>(n);
+        entries = HugePages::malloc_array_on_socket<Entry>(n, numa_node);
+        ctrl = HugePages::malloc_array_on_socket<uint8_t>(n, numa_node);
 
         // We use key=max u64 as forbidden EMPTY sentinel; change if you need full key-space
         for (uint64_t i = 0; i < n; ++i) {
@@ -62,6 +62,7 @@ struct RHBSU64Map {
                 entries[i].val = v;
                 ctrl[i] = dist;
                 ++sz;
+                ++epoch; // robin-hood swaps may have moved entries
                 return true;
             }
             if (entries[i].key == k) {
@@ -117,6 +118,7 @@ struct RHBSU64Map {
             if (entries[i].key == k) {
                 backshift_delete(i);
                 --sz;
+                ++epoch; // entries shifted left
                 return true;
             }
             i = (i + 1) & mask;
@@ -138,13 +140,19 @@ struct RHBSU64Map {
 
     template <class Callback>
     bool clock_sweep_next(Callback&& cb) {
+        return sweep_next(sweep_, std::forward<Callback>(cb));
+    }
+
+    // same as clock_sweep_next, but with a caller-owned hand
+    template <class Callback>
+    bool sweep_next(size_t& hand, Callback&& cb) {
         if (sz == 0)
             return false;
 
         size_t scanned = 0;
         while (scanned < n) {
-            size_t idx = sweep_;
-            sweep_ = (sweep_ + 1) & mask; // advance hand regardless (fairness)
+            size_t idx = hand;
+            hand = (hand + 1) & mask; // advance hand regardless (fairness)
 
             if (ctrl[idx] != 0) { // occupied (no tombstones in backshift scheme)
                 // Deduce callback return type
@@ -244,4 +252,5 @@ private:
 
 public:
     size_t sweep_ = 0;
+    uint64_t epoch = 0; // bumped whenever Value pointers may have been invalidated
 };
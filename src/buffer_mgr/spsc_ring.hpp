@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstddef>
+#include <utility>
+#include <vector>
 
 template <typename T, size_t CAP_POW2>
 struct SpscRing {
@@ -40,3 +42,54 @@ struct SpscRing {
         return size() == CAP_POW2;
     }
 };
+
+
+// Single-threaded FIFO with the SpscRing interface that doubles its capacity
+// when full, so the number of fibers is not fixed at compile time.
+template <typename T>
+struct GrowableRing {
+    std::vector<T> buf_ = std::vector<T>(64);
+    size_t mask = 63;
+    size_t head_ = 0, tail_ = 0;
+
+    inline bool push(T& v) {
+        if (full()) [[unlikely]]
+            grow();
+        buf_[tail_ & mask] = v;
+        ++tail_;
+        return true;
+    }
+
+    inline bool pop(T& out) noexcept {
+        if (empty()) [[unlikely]]
+            return false; // empty
+        out = buf_[head_ & mask];
+        ++head_;
+        return true;
+    }
+
+    inline bool empty() const noexcept {
+        return head_ == tail_;
+    }
+
+    inline size_t size() const noexcept {
+        return tail_ - head_;
+    }
+
+    inline bool full() const noexcept {
+        return size() == buf_.size();
+    }
+
+private:
+    void grow() {
+        std::vector<T> bigger(buf_.size() * 2);
+        size_t n = size();
+        for (size_t i = 0; i < n; ++i) {
+            bigger[i] = buf_[(head_ + i) & mask];
+        }
+        buf_ = std::move(bigger);
+        mask = buf_.size() - 1;
+        head_ = 0;
+        tail_ = n;
+    }
+};
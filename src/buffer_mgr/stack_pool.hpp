@@ -0,0 +1,102 @@
+#pragma once
+
+#include "utils/hugepages.hpp"
+#include "utils/literals.hpp"
+#include "utils/my_asserts.hpp"
+
+#include <algorithm>
+#include <boost/context/stack_context.hpp>
+#include <cstdint>
+#include <sys/mman.h>
+#include <utility>
+#include <vector>
+
+
+// Fiber stacks carved out of huge page chunks and recycled when a fiber ends,
+// instead of one malloc per fiber. Debug builds use small pages and make the
+// page below every stack a PROT_NONE guard, huge pages cannot be protected
+// partially. Release builds keep the gap unprotected: at a power-of-two stride
+// the hot tops of all stacks map to the same cache sets.
+struct StackPool {
+    static constexpr size_t kGuard = 4_KiB;
+    static constexpr size_t kChunk = 8_MiB;
+
+    size_t stack_size = 128_KiB; // usable bytes, set before the first fiber is spawned
+
+    std::vector<std::pair<void*, size_t>> chunks;
+    std::vector<void*> free; // lowest usable address of each idle stack
+    uint64_t in_use = 0;
+    uint64_t reserved = 0; // bytes mapped for stacks and guard pages
+
+    StackPool() = default;
+    StackPool(const StackPool&) = delete;
+
+    ~StackPool() {
+        for (auto [ptr, size] : chunks) {
+#ifdef DEBUG
+            check_ret(munmap(ptr, size));
+#else
+            HugePages::free(ptr, size);
+#endif
+        }
+    }
+
+    void* get() {
+        if (free.empty()) [[unlikely]] {
+            grow();
+        }
+        void* stack = free.back();
+        free.pop_back();
+        ++in_use;
+        return stack;
+    }
+
+    void put(void* stack) {
+        free.push_back(stack);
+        --in_use;
+    }
+
+private:
+    void grow() {
+        ensure(stack_size % 4_KiB == 0);
+        size_t slot = stack_size + kGuard;
+        size_t size = std::max(kChunk, slot);
+
+#ifdef DEBUG
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        ensure(mem != MAP_FAILED);
+        size_t usable = size;
+#else
+        void* mem = HugePages::malloc(size);
+        size_t usable = size + HugePages::PAGE_SIZE - size % HugePages::PAGE_SIZE; // as rounded by HugePages
+#endif
+        chunks.emplace_back(mem, size);
+        reserved += usable;
+
+        auto* base = static_cast<uint8_t*>(mem);
+        for (size_t off = 0; off + slot <= usable; off += slot) {
+#ifdef DEBUG
+            check_ret(mprotect(base + off, kGuard, PROT_NONE)); // stacks grow down into it
+#endif
+            free.push_back(base + off + kGuard);
+        }
+    }
+};
+
+
+// boost::context StackAllocator handing out StackPool stacks. A copy lives in
+// the fiber's control record, so it only holds the pool.
+struct PooledStack {
+    StackPool* pool;
+
+    boost::context::stack_context allocate() {
+        boost::context::stack_context sctx;
+        sctx.size = pool->stack_size;
+        sctx.sp = static_cast<uint8_t*>(pool->get()) + sctx.size;
+        return sctx;
+    }
+
+    void deallocate(boost::context::stack_context& sctx) noexcept {
+        pool->put(static_cast<uint8_t*>(sctx.sp) - sctx.size);
+    }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "utils/my_asserts.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+
+// Bounded FIFO with one producer and any number of consumers, the owning
+// reactor pushes fibers that may migrate and every reactor takes from the
+// head (the top end of a Chase-Lev deque). A consumer reads its slot before
+// claiming it with the CAS on head, the producer only reuses a slot once
+// head moved past it, so a stale read always loses the CAS.
+template <typename T>
+struct StealQueue {
+    std::unique_ptr<std::atomic<T>[]> buf_;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head_ = 0;
+    alignas(64) std::atomic<size_t> tail_ = 0;
+
+    void init(size_t capacity) {
+        size_t cap = 1;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        buf_ = std::make_unique<std::atomic<T>[]>(cap);
+        mask = cap - 1;
+    }
+
+    // owner only
+    inline bool push(T v) noexcept {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - head_.load(std::memory_order_acquire) > mask) [[unlikely]]
+            return false; // full
+        buf_[t & mask].store(v, std::memory_order_relaxed);
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // any thread
+    inline bool pop(T& out) noexcept {
+        size_t h = head_.load(std::memory_order_acquire);
+        while (true) {
+            if (h >= tail_.load(std::memory_order_acquire)) {
+                return false; // empty
+            }
+            out = buf_[h & mask].load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+    }
+
+    inline size_t size() const noexcept {
+        size_t t = tail_.load(std::memory_order_acquire);
+        size_t h = head_.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "utils/literals.hpp"
+#include "utils/rdtsc_clock.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+// Adaptive submission batching (--submit_policy=adaptive).
+//
+// Submits once `target` I/Os are queued or the oldest of them waited for
+// `deadline` cycles, whichever comes first. After every epoch the target
+// grows by one while the completion latency (queued until completed) stays
+// within kSlack of the fastest epoch seen, and shrinks when it does not or
+// when most batches only went out because of the deadline. The deadline is
+// kSlack of that fastest latency: waiting longer costs more than a syscall.
+struct SubmitBatcher {
+    static constexpr uint64_t kEpoch = 4096; // completions
+    static constexpr double kSlack = 0.25;
+
+    uint32_t target = 1;
+    uint32_t max_target = 1;
+    uint64_t deadline = 2.4_GHz / 100'000; // 10us until the first epoch
+    uint64_t first_queued = 0;             // oldest unsubmitted I/O
+
+    uint64_t best_latency = ~0ull; // cycles, drifts up slowly to follow the device
+
+    // current epoch
+    uint64_t completions = 0;
+    uint64_t latency_sum = 0;
+    uint64_t submits = 0;
+    uint64_t submitted = 0;
+    uint64_t deadline_submits = 0;
+
+    void init(int fibers) {
+        max_target = std::max(fibers, 1);
+        target = std::max(max_target / 4, 1u);
+    }
+
+    // returns the timestamp for Op::queued
+    uint64_t queued(int to_submit) {
+        uint64_t now = RDTSCClock::read();
+        if (to_submit == 1) {
+            first_queued = now;
+        }
+        return now;
+    }
+
+    bool expired() const {
+        return RDTSCClock::read() - first_queued >= deadline;
+    }
+
+    bool due(int to_submit) const {
+        return static_cast<uint32_t>(to_submit) >= target || expired();
+    }
+
+    void submitting(int n, bool by_deadline) {
+        ++submits;
+        submitted += n;
+        deadline_submits += by_deadline;
+    }
+
+    void completed(uint64_t queued_at) {
+        if (queued_at == 0) {
+            return; // not timed, e.g. batched writes
+        }
+        latency_sum += RDTSCClock::read() - queued_at;
+        if (++completions == kEpoch) {
+            retune();
+        }
+    }
+
+private:
+    void retune() {
+        uint64_t latency = latency_sum / completions;
+        best_latency = std::min(best_latency + best_latency / 64, latency);
+
+        bool starved = deadline_submits * 2 > submits; // batches rarely fill up
+        if (starved) {
+            uint32_t filled = submits ? (submitted + submits - 1) / submits : 1;
+            target = std::max(1u, std::min(target - 1, filled));
+        } else if (latency <= best_latency * (1 + kSlack)) {
+            target = std::min(target + 1, max_target);
+        } else {
+            target = std::max(1u, target * 3 / 4);
+        }
+        deadline = std::max<uint64_t>(best_latency * kSlack, 1);
+
+        completions = 0;
+        latency_sum = 0;
+        submits = 0;
+        submitted = 0;
+        deadline_submits = 0;
+    }
+};
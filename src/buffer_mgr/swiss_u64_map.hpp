@@ -0,0 +1,217 @@
+#pragma once
+#include "utils/hugepages.hpp"
+#include "utils/my_asserts.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// fixed-size swiss table (u64 -> u64), drop-in for RHBSU64Map
+//
+// Slots are split into groups of kGroup control bytes which are matched with
+// a single SIMD compare: 64 with AVX-512BW, otherwise 16 with SSE2. A full
+// slot stores the low 7 bits of the hash, so the high bit marks free slots.
+// Entries never move, pointers returned by find() stay valid until erase().
+
+template <typename Value>
+struct SwissU64Map {
+    struct Entry {
+        uint64_t key;
+        Value val;
+    };
+    static_assert(sizeof(Value) <= sizeof(uint64_t));
+
+#if defined(__AVX512BW__)
+    static constexpr size_t kGroup = 64;
+    using Mask = uint64_t;
+#else
+    static constexpr size_t kGroup = 16;
+    using Mask = uint32_t;
+#endif
+
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr uint8_t kDeleted = 0xfe;
+
+    explicit SwissU64Map(size_t capacity_pow2, int numa_node = -1)
+        : n(capacity_pow2), mask(capacity_pow2 - 1), group_mask(capacity_pow2 / kGroup - 1) {
+        if (n < kGroup || (n & (n - 1)))
+            throw std::invalid_argument("capacity must be power of two and hold a group");
+
+        entries = HugePages::malloc_array_on_socket<Entry>(n, numa_node);
+        ctrl = HugePages::malloc_array_on_socket<uint8_t>(n, numa_node); // page aligned, groups are aligned loads
+        std::memset(ctrl, kEmpty, n);
+    }
+
+    ~SwissU64Map() {
+        HugePages::free_array<Entry>(entries, n);
+        HugePages::free_array<uint8_t>(ctrl, n);
+    }
+
+    SwissU64Map(const SwissU64Map&) = delete;
+    SwissU64Map& operator=(const SwissU64Map&) = delete;
+
+    // Insert or update. Returns true if inserted new, false if updated existing.
+    bool insert(uint64_t k, Value v) {
+        if (Value* existing = find(k)) {
+            *existing = v;
+            return false;
+        }
+
+        uint64_t h = hash(k);
+        size_t g = group(h);
+        for (size_t probes = 0; probes <= group_mask; ++probes) {
+            size_t base = g * kGroup;
+            Mask free = match_free(base);
+            if (free) {
+                size_t i = base + std::countr_zero(free);
+                entries[i].key = k;
+                entries[i].val = v;
+                ctrl[i] = tag(h);
+                ++sz;
+                return true;
+            }
+            g = (g + 1) & group_mask;
+        }
+        ensure(false, "table full");
+        return false;
+    }
+
+    // Returns pointer to value or nullptr if not found.
+    Value* find(uint64_t k) {
+        size_t i = slot_of(k);
+        return i == n ? nullptr : &entries[i].val;
+    }
+
+    bool erase(uint64_t k) {
+        size_t i = slot_of(k);
+        if (i == n)
+            return false;
+        // a group with an empty slot never made a probe move on, no tombstone needed
+        size_t base = i & ~(kGroup - 1);
+        ctrl[i] = match(base, kEmpty) ? kEmpty : kDeleted;
+        entries[i].key = 0;
+        --sz;
+        return true;
+    }
+
+    size_t size() const {
+        return sz;
+    }
+    size_t capacity() const {
+        return n;
+    }
+    double load_factor() const {
+        return double(sz) / double(n);
+    }
+
+
+    template <class Callback>
+    bool clock_sweep_next(Callback&& cb) {
+        return sweep_next(sweep_, std::forward<Callback>(cb));
+    }
+
+    // same as clock_sweep_next, but with a caller-owned hand
+    template <class Callback>
+    bool sweep_next(size_t& hand, Callback&& cb) {
+        if (sz == 0)
+            return false;
+
+        size_t scanned = 0;
+        while (scanned < n) {
+            size_t idx = hand;
+            hand = (hand + 1) & mask; // advance hand regardless (fairness)
+
+            if (!(ctrl[idx] & kEmpty)) { // occupied, empty and deleted have the high bit set
+                using Ret = std::invoke_result_t<Callback, uint64_t, Value&>;
+                if constexpr (std::is_same_v<Ret, bool>) {
+                    if (cb(entries[idx].key, entries[idx].val))
+                        return true; // accepted by callback
+                } else {
+                    cb(entries[idx].key, entries[idx].val); // one-and-done
+                    return true;
+                }
+            }
+            ++scanned;
+        }
+        return false; // no occupied slot accepted in a full rotation
+    }
+
+    template <class Callback>
+    void dump(Callback&& cb) {
+        for (size_t idx = 0; idx < n; ++idx) {
+            if (!(ctrl[idx] & kEmpty)) {
+                auto key = entries[idx].key;
+                cb(key, entries[idx].val, group(hash(key)) * kGroup, idx);
+            }
+        }
+    }
+
+
+private:
+    // splitmix64, same as RHBSU64Map
+    static uint64_t hash(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    static uint8_t tag(uint64_t h) {
+        return h & 0x7f;
+    }
+
+    size_t group(uint64_t h) const {
+        return (h >> 7) & group_mask;
+    }
+
+    // bit i set if ctrl[base + i] == byte
+    Mask match(size_t base, uint8_t byte) const {
+#if defined(__AVX512BW__)
+        __m512i c = _mm512_load_si512(ctrl + base);
+        return _mm512_cmpeq_epi8_mask(c, _mm512_set1_epi8(byte));
+#else
+        __m128i c = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl + base));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(byte)));
+#endif
+    }
+
+    // bit i set if ctrl[base + i] is empty or deleted
+    Mask match_free(size_t base) const {
+#if defined(__AVX512BW__)
+        return _mm512_movepi8_mask(_mm512_load_si512(ctrl + base));
+#else
+        return _mm_movemask_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(ctrl + base)));
+#endif
+    }
+
+    // slot index of k, or n if not present
+    size_t slot_of(uint64_t k) const {
+        uint64_t h = hash(k);
+        uint8_t t = tag(h);
+        size_t g = group(h);
+        for (size_t probes = 0; probes <= group_mask; ++probes) {
+            size_t base = g * kGroup;
+            for (Mask m = match(base, t); m; m &= m - 1) {
+                size_t i = base + std::countr_zero(m);
+                if (entries[i].key == k) [[likely]]
+                    return i;
+            }
+            if (match(base, kEmpty)) [[likely]]
+                return n; // probe sequences end at the first group with an empty slot
+            g = (g + 1) & group_mask;
+        }
+        return n;
+    }
+
+    Entry* entries = nullptr;
+    uint8_t* ctrl = nullptr;
+    size_t n = 0, mask = 0, group_mask = 0, sz = 0;
+
+public:
+    size_t sweep_ = 0;
+    static constexpr uint64_t epoch = 0; // entries never move
+};
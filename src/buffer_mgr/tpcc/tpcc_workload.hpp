@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <vector>
 
 extern __thread uint16_t workerThreadId;
@@ -153,6 +154,52 @@ struct TPCCWorkload {
         }
         neworder.insert({w_id, d_id, o_id}, {});
 
+        // read all stock rows of the order at once, their faults overlap
+        // (s_dist is not touched by the updates below)
+        std::vector<stock_t::Key> stockKeys;
+        stockKeys.reserve(lineNumbers.size());
+        for (unsigned i = 0; i < lineNumbers.size(); i++) {
+            stockKeys.push_back({w_id, itemids[i]});
+        }
+        std::vector<Varchar<24>> s_dists(lineNumbers.size());
+        stock.lookupBatch(std::span<const stock_t::Key>(stockKeys), [&](unsigned i, const stock_t& rec) {
+            switch (d_id) {
+                case 1:
+                    s_dists[i] = rec.s_dist_01;
+                    break;
+                case 2:
+                    s_dists[i] = rec.s_dist_02;
+                    break;
+                case 3:
+                    s_dists[i] = rec.s_dist_03;
+                    break;
+                case 4:
+                    s_dists[i] = rec.s_dist_04;
+                    break;
+                case 5:
+                    s_dists[i] = rec.s_dist_05;
+                    break;
+                case 6:
+                    s_dists[i] = rec.s_dist_06;
+                    break;
+                case 7:
+                    s_dists[i] = rec.s_dist_07;
+                    break;
+                case 8:
+                    s_dists[i] = rec.s_dist_08;
+                    break;
+                case 9:
+                    s_dists[i] = rec.s_dist_09;
+                    break;
+                case 10:
+                    s_dists[i] = rec.s_dist_10;
+                    break;
+                default:
+                    exit(1);
+                    throw;
+            }
+        });
+
         for (unsigned i = 0; i < lineNumbers.size(); i++) {
             Integer qty = qtys[i];
             stock.update1(
@@ -173,44 +220,7 @@ struct TPCCWorkload {
             Numeric qty = qtys[i];
 
             Numeric i_price = item.lookupField({itemid}, &item_t::i_price); // TODO: rollback on miss
-            Varchar<24> s_dist;
-            stock.lookup1({w_id, itemid}, [&](const stock_t& rec) {
-                switch (d_id) {
-                    case 1:
-                        s_dist = rec.s_dist_01;
-                        break;
-                    case 2:
-                        s_dist = rec.s_dist_02;
-                        break;
-                    case 3:
-                        s_dist = rec.s_dist_03;
-                        break;
-                    case 4:
-                        s_dist = rec.s_dist_04;
-                        break;
-                    case 5:
-                        s_dist = rec.s_dist_05;
-                        break;
-                    case 6:
-                        s_dist = rec.s_dist_06;
-                        break;
-                    case 7:
-                        s_dist = rec.s_dist_07;
-                        break;
-                    case 8:
-                        s_dist = rec.s_dist_08;
-                        break;
-                    case 9:
-                        s_dist = rec.s_dist_09;
-                        break;
-                    case 10:
-                        s_dist = rec.s_dist_10;
-                        break;
-                    default:
-                        exit(1);
-                        throw;
-                }
-            });
+            const Varchar<24>& s_dist = s_dists[i];
             Numeric ol_amount = qty * i_price * (1.0 + w_tax + d_tax) * (1.0 - c_discount);
             Timestamp ol_delivery_d = 0; // NULL
             orderline.insert({w_id, d_id, o_id, lineNumber}, {itemid, supware, ol_delivery_d, qty, ol_amount, s_dist});
@@ -246,16 +256,17 @@ struct TPCCWorkload {
     }
     void delivery(Integer w_id, Integer carrier_id, Timestamp datetime) {
         for (Integer d_id = 1; d_id <= 10; d_id++) {
+            u8 wd[2 * sizeof(Integer)];
+            foldFields(wd, w_id, d_id);
             Integer o_id = minInteger;
             neworder.scan(
                 {w_id, d_id, minInteger},
-                [&](const neworder_t::Key& key, const neworder_t&) {
-                    if (key.no_w_id == w_id && key.no_d_id == d_id) {
-                        o_id = key.no_o_id;
+                [&](const auto& key, const neworder_t&) {
+                    if (key.startsWith(wd)) {
+                        o_id = key.key().no_o_id;
                     }
                     return false;
-                },
-                [&]() { o_id = minInteger; });
+                });
             if (o_id == minInteger) { // Should rarely happen
                 std::cout << "WARNING: delivery tx skipped for warehouse = " << w_id << ", district = " << d_id << std::endl;
                 continue;
@@ -268,12 +279,11 @@ struct TPCCWorkload {
             if (manually_handle_isolation_anomalies) {
                 order.scan(
                     {w_id, d_id, o_id},
-                    [&](const order_t::Key&, const order_t& rec) {
+                    [&](const auto&, const order_t& rec) {
                         ol_cnt = rec.o_ol_cnt;
                         c_id = rec.o_c_id;
                         return false;
-                    },
-                    [&]() {});
+                    });
                 if (ol_cnt == minInteger)
                     continue;
             } else {
@@ -284,10 +294,12 @@ struct TPCCWorkload {
             }
             if (manually_handle_isolation_anomalies) {
                 bool is_safe_to_continue = false;
+                u8 wdo[3 * sizeof(Integer)];
+                foldFields(wdo, w_id, d_id, o_id);
                 order.scan(
                     {w_id, d_id, o_id},
-                    [&](const order_t::Key& key, const order_t& rec) {
-                        if (key.o_w_id == w_id && key.o_d_id == d_id && key.o_id == o_id) {
+                    [&](const auto& key, const order_t& rec) {
+                        if (key.compare(wdo) == 0) {
                             is_safe_to_continue = true;
                             ol_cnt = rec.o_ol_cnt;
                             c_id = rec.o_c_id;
@@ -295,8 +307,7 @@ struct TPCCWorkload {
                             is_safe_to_continue = false;
                         }
                         return false;
-                    },
-                    [&]() { is_safe_to_continue = false; });
+                    });
                 if (!is_safe_to_continue)
                     continue;
             }
@@ -305,17 +316,18 @@ struct TPCCWorkload {
             if (manually_handle_isolation_anomalies) {
                 // First check if all orderlines have been inserted, a hack because of the missing transaction and concurrency control
                 bool is_safe_to_continue = false;
+                u8 wdon[4 * sizeof(Integer)];
+                foldFields(wdon, w_id, d_id, o_id, ol_cnt);
                 orderline.scan(
                     {w_id, d_id, o_id, ol_cnt},
-                    [&](const orderline_t::Key& key, const orderline_t&) {
-                        if (key.ol_w_id == w_id && key.ol_d_id == d_id && key.ol_o_id == o_id && key.ol_number == ol_cnt) {
+                    [&](const auto& key, const orderline_t&) {
+                        if (key.compare(wdon) == 0) {
                             is_safe_to_continue = true;
                         } else {
                             is_safe_to_continue = false;
                         }
                         return false;
-                    },
-                    [&]() { is_safe_to_continue = false; });
+                    });
                 if (!is_safe_to_continue) {
                     continue;
                 }
@@ -359,16 +371,17 @@ struct TPCCWorkload {
         std::vector<Integer> items;
         items.reserve(100);
         Integer min_ol_o_id = o_id - 20;
+        u8 end[3 * sizeof(Integer)]; // (w_id, d_id, o_id) sorts after every orderline of older orders
+        foldFields(end, w_id, d_id, o_id);
         orderline.scan(
             {w_id, d_id, min_ol_o_id, minInteger},
-            [&](const orderline_t::Key& key, const orderline_t& rec) {
-                if (key.ol_w_id == w_id && key.ol_d_id == d_id && key.ol_o_id < o_id && key.ol_o_id >= min_ol_o_id) {
+            [&](const auto& key, const orderline_t& rec) {
+                if (key.compare(end) < 0) {
                     items.push_back(rec.ol_i_id);
                     return true;
                 }
                 return false;
-            },
-            [&]() { items.clear(); });
+            });
         std::sort(items.begin(), items.end());
         auto last = std::unique(items.begin(), items.end());
         items.erase(last, items.end());
@@ -379,6 +392,40 @@ struct TPCCWorkload {
         }
     }
     void stockLevelRnd(Integer w_id) { stockLevel(w_id, urand(1, 10), urand(10, 20)); }
+
+    // CH-benCHmark Q6 over the whole orderline table, the analytical side of
+    // the HTAP mode:
+    //   SELECT SUM(ol_amount) FROM orderline
+    //   WHERE ol_delivery_d >= ? AND ol_delivery_d < ? AND ol_quantity BETWEEN 1 AND 100000
+    // Scans `chunk` records at a time and calls pause() in between, so the
+    // fibers sharing the reactor are not starved by a scan that hits memory.
+    template <class Pause>
+    Numeric chQuery6(unsigned chunk, Pause pause, u64& rows, Timestamp from = 1, Timestamp to = std::numeric_limits<Timestamp>::max()) {
+        Numeric revenue = 0;
+        orderline_t::Key next = {minInteger, minInteger, minInteger, minInteger};
+        bool more = true;
+        while (more) {
+            unsigned n = 0;
+            more = false;
+            orderline.scan(next, [&](const auto& key, const orderline_t& rec) {
+                if (n == chunk) { // continue from here
+                    next = key.key();
+                    more = true;
+                    return false;
+                }
+                ++n;
+                if (rec.ol_delivery_d >= from && rec.ol_delivery_d < to && rec.ol_quantity >= 1 && rec.ol_quantity <= 100000) {
+                    revenue += rec.ol_amount;
+                }
+                return true;
+            });
+            rows += n;
+            if (more) {
+                pause();
+            }
+        }
+        return revenue;
+    }
     void orderStatusId(Integer w_id, Integer d_id, Integer c_id) {
         Varchar<16> c_first;
         Varchar<2> c_middle;
@@ -391,30 +438,31 @@ struct TPCCWorkload {
             c_balance = rec.c_balance;
         });
 
+        u8 wd[2 * sizeof(Integer)];
+        foldFields(wd, w_id, d_id);
         Integer o_id = -1;
         // latest order id desc
         if (order_wdc_index) {
             order_wdc.scanDesc(
                 {w_id, d_id, c_id, std::numeric_limits<Integer>::max()},
-                [&](const order_wdc_t::Key& key, const order_wdc_t&) {
-                    assert(key.o_w_id == w_id);
-                    assert(key.o_d_id == d_id);
-                    assert(key.o_c_id == c_id);
-                    o_id = key.o_id;
+                [&](const auto& key, const order_wdc_t&) {
+                    auto k = key.key();
+                    assert(k.o_w_id == w_id);
+                    assert(k.o_d_id == d_id);
+                    assert(k.o_c_id == c_id);
+                    o_id = k.o_id;
                     return false;
-                },
-                [] {});
+                });
         } else {
             order.scanDesc(
                 {w_id, d_id, std::numeric_limits<Integer>::max()},
-                [&](const order_t::Key& key, const order_t& rec) {
-                    if (key.o_w_id == w_id && key.o_d_id == d_id && rec.o_c_id == c_id) {
-                        o_id = key.o_id;
+                [&](const auto& key, const order_t& rec) {
+                    if (key.startsWith(wd) && rec.o_c_id == c_id) {
+                        o_id = key.key().o_id;
                         return false;
                     }
                     return true;
-                },
-                [&]() {});
+                });
         }
         if (o_id == -1)
             return;
@@ -432,10 +480,12 @@ struct TPCCWorkload {
         Numeric ol_amount;
         {
             // AAA: expensive
+            u8 wdo[3 * sizeof(Integer)];
+            foldFields(wdo, w_id, d_id, o_id);
             orderline.scan(
                 {w_id, d_id, o_id, minInteger},
-                [&](const orderline_t::Key& key, const orderline_t& rec) {
-                    if (key.ol_w_id == w_id && key.ol_d_id == d_id && key.ol_o_id == o_id) {
+                [&](const auto& key, const orderline_t& rec) {
+                    if (key.startsWith(wdo)) {
                         ol_i_id = rec.ol_i_id;
                         ol_supply_w_id = rec.ol_supply_w_id;
                         ol_delivery_d = rec.ol_delivery_d;
@@ -444,24 +494,22 @@ struct TPCCWorkload {
                         return true;
                     }
                     return false;
-                },
-                [&]() {
-                    // NOTHING
                 });
         }
     }
     void orderStatusName(Integer w_id, Integer d_id, Varchar<16> c_last) {
         std::vector<Integer> ids;
+        u8 wdl[customer_wdl_t::maxFoldLength()];
+        unsigned wdl_len = foldFields(wdl, w_id, d_id, c_last);
         customerwdl.scan(
             {w_id, d_id, c_last, {}},
-            [&](const customer_wdl_t::Key& key, const customer_wdl_t& rec) {
-                if (key.c_w_id == w_id && key.c_d_id == d_id && key.c_last == c_last) {
+            [&](const auto& key, const customer_wdl_t& rec) {
+                if (key.startsWith({wdl, wdl_len})) {
                     ids.push_back(rec.c_id);
                     return true;
                 }
                 return false;
-            },
-            [&]() { ids.clear(); });
+            });
         unsigned c_count = ids.size();
         if (c_count == 0)
             return; // TODO: rollback
@@ -470,41 +518,40 @@ struct TPCCWorkload {
             index -= 1;
         Integer c_id = ids[index];
 
+        u8 wdc[3 * sizeof(Integer)];
+        foldFields(wdc, w_id, d_id, c_id);
         Integer o_id = -1;
         // latest order id desc
         if (order_wdc_index) {
             order_wdc.scanDesc(
                 {w_id, d_id, c_id, std::numeric_limits<Integer>::max()},
-                [&](const order_wdc_t::Key& key, const order_wdc_t&) {
-                    if (key.o_w_id == w_id && key.o_d_id == d_id && key.o_c_id == c_id)
-                        o_id = key.o_id;
+                [&](const auto& key, const order_wdc_t&) {
+                    if (key.startsWith(wdc))
+                        o_id = key.key().o_id;
                     return false;
-                },
-                [] {});
+                });
         } else {
             order.scanDesc(
                 {w_id, d_id, std::numeric_limits<Integer>::max()},
-                [&](const order_t::Key& key, const order_t& rec) {
-                    if (key.o_w_id == w_id && key.o_d_id == d_id && rec.o_c_id == c_id)
-                        o_id = key.o_id;
+                [&](const auto& key, const order_t& rec) {
+                    if (key.startsWith({wdc, 2 * sizeof(Integer)}) && rec.o_c_id == c_id)
+                        o_id = key.key().o_id;
                     return false;
-                },
-                [&]() {});
+                });
         }
         if (o_id == -1)
             return;
+        u8 wdo[3 * sizeof(Integer)];
+        foldFields(wdo, w_id, d_id, o_id);
         Timestamp ol_delivery_d;
         orderline.scan(
             {w_id, d_id, o_id, minInteger},
-            [&](const orderline_t::Key& key, const orderline_t& rec) {
-                if (key.ol_w_id == w_id && key.ol_d_id == d_id && key.ol_o_id == o_id) {
+            [&](const auto& key, const orderline_t& rec) {
+                if (key.startsWith(wdo)) {
                     ol_delivery_d = rec.ol_delivery_d;
                     return true;
                 }
                 return false;
-            },
-            []() {
-                // NOTHING
             });
     }
 
@@ -647,16 +694,17 @@ struct TPCCWorkload {
 
         // Get customer id by name
         std::vector<Integer> ids;
+        u8 wdl[customer_wdl_t::maxFoldLength()];
+        unsigned wdl_len = foldFields(wdl, c_w_id, c_d_id, c_last);
         customerwdl.scan(
             {c_w_id, c_d_id, c_last, {}},
-            [&](const customer_wdl_t::Key& key, const customer_wdl_t& rec) {
-                if (key.c_w_id == c_w_id && key.c_d_id == c_d_id && key.c_last == c_last) {
+            [&](const auto& key, const customer_wdl_t& rec) {
+                if (key.startsWith({wdl, wdl_len})) {
                     ids.push_back(rec.c_id);
                     return true;
                 }
                 return false;
-            },
-            [&]() { ids.clear(); });
+            });
         unsigned c_count = ids.size();
         if (c_count == 0)
             return; // TODO: rollback
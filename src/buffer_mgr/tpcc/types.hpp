@@ -81,6 +81,14 @@ unsigned fold(u8* writer, const Varchar<len>& x) {
     return x.length + 1;
 }
 
+// Folds the leading fields of a key, to check scanned keys without unfolding them
+template <class... Fields>
+unsigned foldFields(u8* writer, const Fields&... fields) {
+    unsigned pos = 0;
+    ((pos += fold(writer + pos, fields)), ...);
+    return pos;
+}
+
 unsigned unfold(const u8* input, Integer& x);
 unsigned unfold(const u8* input, Timestamp& x);
 unsigned unfold(const u8* input, u64& x);
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "utils/latency.hpp"
+#include "utils/my_asserts.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// TPC-C latency per transaction type (--tx_latency=<csv>), one per shard.
+// Every transaction is timed from its start to the commit, the part its
+// fiber was running is taken from Reactor::run_cycles, the rest it was
+// parked on I/O or waiting in the ready queue. Histograms in ns with the
+// buckets of latency::Histogram.
+struct TxLatencies {
+    static constexpr unsigned kTypes = 5;
+    static constexpr const char* names[kTypes] = {"payment", "orderStatus", "delivery", "stockLevel", "newOrder"}; // TPCCWorkload::tx
+    static constexpr double kCyclesPerNs = 2.4; // RDTSCClock
+    static constexpr double kPercentiles[] = {50, 99, 99.9};
+
+    struct Type {
+        latency::Histogram total;
+        latency::Histogram running;
+        uint64_t count = 0;
+        uint64_t total_cycles = 0;
+        uint64_t run_cycles = 0;
+    };
+    Type types[kTypes];
+
+    TxLatencies() {
+        for (auto& t : types) {
+            t.total.init();
+            t.running.init();
+        }
+    }
+    ~TxLatencies() {
+        for (auto& t : types) {
+            free(t.total.plat);
+            free(t.running.plat);
+        }
+    }
+    TxLatencies(const TxLatencies&) = delete;
+
+    void add(int type, uint64_t cycles, uint64_t run_cycles) {
+        auto& t = types[type];
+        t.total.add(cycles / kCyclesPerNs);
+        t.running.add(run_cycles / kCyclesPerNs);
+        ++t.count;
+        t.total_cycles += cycles;
+        t.run_cycles += run_cycles;
+    }
+
+    void merge(const TxLatencies& other) {
+        for (unsigned i = 0; i < kTypes; ++i) {
+            auto& t = types[i];
+            auto& o = other.types[i];
+            for (unsigned b = 0; b < latency::PLAT_NR; ++b) {
+                t.total.plat[b] += o.total.plat[b];
+                t.running.plat[b] += o.running.plat[b];
+            }
+            t.count += o.count;
+            t.total_cycles += o.total_cycles;
+            t.run_cycles += o.run_cycles;
+        }
+    }
+
+    // p-th percentile in ns of the n samples in plat
+    static uint64_t percentile(const unsigned long* plat, uint64_t n, double p) {
+        uint64_t sum = 0;
+        for (unsigned b = 0; b < latency::PLAT_NR; ++b) {
+            sum += plat[b];
+            if (sum > 0 && sum >= p / 100 * n) {
+                return latency::plat_idx_to_val(b);
+            }
+        }
+        return 0;
+    }
+
+    void write_csv(const std::string& path) const {
+        std::ofstream csv(path);
+        ensure(csv.good(), "cannot open --tx_latency file");
+        csv << "type,count,mean_us,p50_us,p99_us,p999_us,run_mean_us,run_p50_us,run_p99_us,run_p999_us,parked_pct\n";
+        for (unsigned i = 0; i < kTypes; ++i) {
+            auto& t = types[i];
+            uint64_t n = t.count ? t.count : 1;
+            csv << names[i] << "," << t.count << "," << t.total_cycles / kCyclesPerNs / 1e3 / n;
+            for (double p : kPercentiles) {
+                csv << "," << percentile(t.total.plat, t.count, p) / 1e3;
+            }
+            csv << "," << t.run_cycles / kCyclesPerNs / 1e3 / n;
+            for (double p : kPercentiles) {
+                csv << "," << percentile(t.running.plat, t.count, p) / 1e3;
+            }
+            csv << "," << (t.total_cycles ? 100.0 * (t.total_cycles - t.run_cycles) / t.total_cycles : 0) << "\n";
+        }
+    }
+};
+
+
+// End-to-end percentiles of the last stats interval over all shards
+struct TxLatencyWindow {
+    std::vector<unsigned long> last = std::vector<unsigned long>(TxLatencies::kTypes * latency::PLAT_NR);
+    std::vector<unsigned long> diff = std::vector<unsigned long>(latency::PLAT_NR);
+
+    void print(std::ostream& ss, const TxLatencies* shards, int n) {
+        for (unsigned i = 0; i < TxLatencies::kTypes; ++i) {
+            uint64_t count = 0;
+            for (unsigned b = 0; b < latency::PLAT_NR; ++b) {
+                unsigned long now = 0;
+                for (int s = 0; s < n; ++s) {
+                    now += shards[s].types[i].total.plat[b];
+                }
+                auto& prev = last[i * latency::PLAT_NR + b];
+                diff[b] = now - prev;
+                prev = now;
+                count += diff[b];
+            }
+            ss << " " << TxLatencies::names[i] << "_us=";
+            for (double p : TxLatencies::kPercentiles) {
+                ss << (p == TxLatencies::kPercentiles[0] ? "" : "/") << TxLatencies::percentile(diff.data(), count, p) / 1e3;
+            }
+        }
+    }
+};
@@ -16,7 +16,17 @@ typedef u64 PID; // Page ID (on SSD)
 typedef u64 BID; // Buffer ID (in memory)
 
 
+// one buffer_mgr binary per page size, see CMakeLists.txt
+#ifndef BM_PAGE_SIZE
+#define BM_PAGE_SIZE 4096
+#endif
+
+constexpr u64 pageSize = BM_PAGE_SIZE;
+static_assert(pageSize >= 4096 && pageSize <= 65536 && (pageSize & (pageSize - 1)) == 0, "page size must be a power of two in [4K, 64K]");
+
+
 struct alignas(4096) Page {
+    u8 data[pageSize];
 
     uint64_t checksum() {
         uint64_t checksum = 0;
@@ -0,0 +1,240 @@
+#include "wal.hpp"
+
+#include "config.hpp"
+#include "utils/hugepages.hpp"
+#include "utils/my_asserts.hpp"
+#include "utils/my_logger.hpp"
+#include "utils/nvme.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <libaio.h>
+#include <liburing.h>
+#include <unistd.h>
+
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd < 0) {
+        return;
+    }
+    HugePages::free_array<u8>(group.data, bufferSize);
+    HugePages::free_array<u8>(writing.data, bufferSize);
+    if constexpr (!mini::SIM) {
+        close(fd);
+    }
+}
+
+void WriteAheadLog::init(unsigned shard, int reg_slot) {
+    auto& cfg = bm.cfg;
+
+    int open_flags = O_DIRECT | O_RDWR | O_CREAT;
+    if (cfg.nvme_cmds) {
+        open_flags &= ~(O_DIRECT | O_CREAT);
+    }
+    if constexpr (mini::SIM) {
+        fd = reg_slot; // simulated disk after the data devices
+#ifdef BM_SIM
+        bm.r->size_disk(fd, cfg.wal_size);
+#endif
+    } else {
+        fd = open(cfg.wal.c_str(), open_flags, 0644);
+        check_ret(fd);
+    }
+    sqe_fd = fd;
+
+    if (cfg.nvme_cmds) {
+        // passthrough commands carry nsid and lba_shift of the data devices
+        uint32_t data_nsid = nsid;
+        uint32_t data_lba_shift = lba_shift;
+        nvme_get_info(fd);
+        ensure(nsid == data_nsid && lba_shift == data_lba_shift, "log device must be formatted like the data devices");
+    }
+    if (cfg.reg_fds) {
+        check_iou(io_uring_register_files_update(&bm.ring, reg_slot, &fd, 1));
+        sqe_fd = reg_slot;
+    }
+
+    regionSize = cfg.wal_size / cfg.shards / kBlock * kBlock;
+    regionBase = shard * regionSize;
+    bufferSize = cfg.wal_buffer;
+    ensure(bufferSize % kBlock == 0 && bufferSize <= regionSize);
+
+    group.data = HugePages::malloc_array<u8>(bufferSize);
+    writing.data = HugePages::malloc_array<u8>(bufferSize);
+}
+
+void WriteAheadLog::start() {
+    if (fd < 0) {
+        return;
+    }
+    enabled = true;
+
+    log_writer.spawn(
+        [&] {
+            bm.my_id.reset(new uint64_t{0xfc}); // special id for log writer
+        },
+        [&] {
+            if (wal.appendedLsn == wal.durableLsn) {
+                return true; // park
+            }
+            wal.flush();
+            return false; // no park
+        });
+}
+
+LogBuffer& WriteAheadLog::buffer() {
+    auto* f = mini::current();
+    if (!f->local) {
+        buffers.push_back(std::make_unique<LogBuffer>());
+        f->local = buffers.back().get();
+    }
+    return *static_cast<LogBuffer*>(f->local);
+}
+
+void WriteAheadLog::log(LogType type, u8 tree, std::span<u8> key, std::span<u8> payload) {
+    if (!enabled) {
+        return;
+    }
+
+    auto& buf = buffer();
+    LogRecord rec{
+        .len = static_cast<u32>(sizeof(LogRecord) + key.size() + payload.size()),
+        .keyLen = static_cast<u16>(key.size()),
+        .type = static_cast<u8>(type),
+        .tree = tree,
+    };
+
+    size_t off = buf.data.size();
+    buf.data.resize(off + rec.len);
+    u8* dst = buf.data.data() + off;
+    std::memcpy(dst, &rec, sizeof(LogRecord));
+    std::memcpy(dst + sizeof(LogRecord), key.data(), key.size());
+    std::memcpy(dst + sizeof(LogRecord) + key.size(), payload.data(), payload.size());
+}
+
+void WriteAheadLog::commit() {
+    if (!enabled) {
+        return;
+    }
+    auto* f = mini::current();
+    auto* buf = static_cast<LogBuffer*>(f->local);
+    if (!buf || buf->data.empty()) {
+        return; // read-only
+    }
+    log(LogType::Commit, 0, {}, {});
+
+    RDTSCClock clock(2.4_GHz);
+    clock.start();
+
+    u64 len = buf->data.size();
+    ensure(len + kBlock <= bufferSize, "transaction does not fit into the log buffer");
+    while (group.size + len > bufferSize) {
+        spaceWaiters.push_back(f);
+        log_writer.wakeup();
+        mini::park();
+    }
+
+    std::memcpy(group.data + group.size, buf->data.data(), len);
+    group.size += len;
+    appendedLsn = group.lsn + group.size;
+    buf->data.clear();
+    buf->txs++;
+
+    u64 lsn = appendedLsn;
+    waiters.push_back({lsn, f});
+    log_writer.wakeup();
+    while (durableLsn < lsn) {
+        mini::park();
+    }
+
+    clock.stop();
+    commitCycles += clock.cycles();
+    ++commits;
+}
+
+// Writes the current group and makes it durable. The partial last block is
+// carried over into the next group and rewritten by the next flush.
+void WriteAheadLog::flush() {
+    std::swap(group, writing);
+
+    u64 full = writing.size & ~(kBlock - 1);
+    u64 tail = writing.size - full;
+    group.lsn = writing.lsn + full;
+    group.size = tail;
+    std::memcpy(group.data, writing.data + full, tail);
+    for (auto* f : spaceWaiters) {
+        mini::wake(f);
+    }
+    spaceWaiters.clear();
+
+    u64 end = writing.lsn + writing.size;
+    u64 len = (writing.size + kBlock - 1) & ~(kBlock - 1);
+    std::memset(writing.data + writing.size, 0, len - writing.size);
+
+    // split at the end of our region
+    u64 pos = writing.lsn % regionSize;
+    u64 first = std::min(len, regionSize - pos);
+    struct Chunk {
+        u8* data;
+        u64 len;
+        u64 offset;
+    };
+    Chunk chunks[2] = {
+        {writing.data, first, regionBase + pos},
+        {writing.data + first, len - first, regionBase},
+    };
+    int writes = first < len ? 2 : 1;
+
+    auto prep_sqe = [&](int i, struct io_uring_sqe* sqe) {
+        if (i == writes) {
+            if (bm.cfg.nvme_cmds) {
+                prep_nvme_flush(sqe, sqe_fd);
+            } else {
+                io_uring_prep_fsync(sqe, sqe_fd, IORING_FSYNC_DATASYNC);
+            }
+        } else {
+            auto& c = chunks[i];
+            if (bm.cfg.nvme_cmds) {
+                prep_nvme_write(sqe, sqe_fd, c.data, c.len, c.offset);
+            } else {
+                io_uring_prep_write(sqe, sqe_fd, c.data, c.len, c.offset);
+            }
+            sqe->flags |= IOSQE_IO_LINK; // the flush only runs after the writes
+        }
+        if (bm.cfg.reg_fds) {
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+    };
+
+    // libaio has no linked flush, the writes themselves are durable
+    auto prep_libaio = [&](int i, struct iocb* cb) {
+        auto& c = chunks[i];
+        io_prep_pwrite(cb, fd, c.data, c.len, c.offset);
+        cb->aio_rw_flags = RWF_DSYNC;
+    };
+
+    RDTSCClock clock(2.4_GHz);
+    clock.start();
+    mini::Op op;
+    if constexpr (mini::LIBAIO) {
+        mini::io_batch(writes, op, prep_libaio);
+    } else {
+        mini::io_batch(writes + 1, op, prep_sqe);
+    }
+    clock.stop();
+    flushCycles += clock.cycles();
+
+    // no write returns more than it was given and errors already failed in
+    // the reactor, so the sum only matches if every write was complete and
+    // the flush returned 0 (NVMe commands return their status, 0 on success)
+    ensure(op.total == (bm.cfg.nvme_cmds ? 0 : static_cast<int64_t>(len)), "short log write");
+
+    bytesWritten += len;
+    ++flushes;
+
+    durableLsn = end;
+    while (!waiters.empty() && waiters.front().lsn <= durableLsn) {
+        mini::wake(waiters.front().fiber);
+        waiters.pop_front();
+    }
+}
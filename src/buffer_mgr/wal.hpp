@@ -0,0 +1,102 @@
+#pragma once
+
+#include "bm.hpp"
+#include "kuring.hpp"
+#include "types.hpp"
+#include "utils/rdtsc_clock.hpp"
+
+#include <deque>
+#include <memory>
+#include <span>
+#include <vector>
+
+
+// Redo-only write-ahead log, one per shard (thread_local wal).
+//
+// Every fiber collects the records of its running transaction in its own
+// LogBuffer. commit() appends them to the shard's group buffer and parks the
+// fiber until the log writer made them durable. The writer flushes one group
+// at a time (write linked to fsync, or an NVMe flush with --nvme_cmds), so
+// everything that commits during a flush goes out with the next one.
+//
+// Each shard owns cfg.wal_size / shards bytes of the log device and wraps
+// around when it is full; there is no checkpointing or recovery yet.
+
+enum class LogType : u8 {
+    Insert,
+    Update, // after image of the whole payload
+    Remove,
+    Commit,
+};
+
+struct LogRecord {
+    u32 len; // including this header
+    u16 keyLen;
+    u8 type;
+    u8 tree; // BTree slotId
+    // key, payload
+};
+static_assert(sizeof(LogRecord) == 8);
+
+struct LogBuffer {
+    std::vector<u8> data;
+    u64 txs = 0;
+};
+
+struct WriteAheadLog {
+    static constexpr u64 kBlock = 4096; // O_DIRECT and lba granularity
+
+    bool enabled = false;
+    int fd = -1;
+    int sqe_fd = -1;
+
+    u64 regionBase = 0; // byte offset of this shard on the log device
+    u64 regionSize = 0;
+
+    // double buffered: commits append to group while writing is flushed
+    struct Group {
+        u8* data = nullptr;
+        u64 size = 0;
+        u64 lsn = 0; // log offset of data[0], block aligned
+    };
+    Group group;
+    Group writing;
+    u64 bufferSize = 0;
+
+    u64 appendedLsn = 0; // end of the group buffer
+    u64 durableLsn = 0;
+
+    struct Waiter {
+        u64 lsn;
+        Reactor::Fiber* fiber;
+    };
+    std::deque<Waiter> waiters;                 // ordered by lsn
+    std::vector<Reactor::Fiber*> spaceWaiters; // group buffer was full
+    std::vector<std::unique_ptr<LogBuffer>> buffers;
+
+    SleepingFiber log_writer;
+
+    // stats
+    u64 commits = 0;
+    u64 commitCycles = 0; // commit() until durable
+    u64 flushCycles = 0;  // log writes and flush, not in write_cycles
+    u64 flushes = 0;
+    u64 bytesWritten = 0; // including rewritten partial blocks
+
+    ~WriteAheadLog();
+
+    void init(unsigned shard, int reg_slot);
+    // after loading: spawns the writer, records are only collected from now on
+    void start();
+
+    void log(LogType type, u8 tree, std::span<u8> key, std::span<u8> payload);
+    // no-op for transactions that did not log anything
+    void commit();
+
+private:
+    LogBuffer& buffer();
+    void flush();
+};
+
+
+extern thread_local WriteAheadLog wal;
@@ -1,28 +1,27 @@
 #pragma once
+#include "config.hpp"
 #include "tpcc/random_generator.hpp"
 #include "tpcc/types.hpp"
+#include "utils/latency.hpp"
 #include "utils/literals.hpp"
 #include "utils/my_logger.hpp"
 #include "utils/rdtsc_clock.hpp"
 #include "utils/utils.hpp"
+#include "utils/zipf.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <string>
 
-constexpr size_t YCSB_LEN = 128;
 
+constexpr size_t YCSB_LEN = 128;     // default value size
+constexpr size_t YCSB_MAX_LEN = 960; // with key and length below BTreeNode::maxKVSize of 4 KiB pages
 
-template <u64 size>
-struct BytesPayload {
-    u8 value[size];
-
-    BytesPayload() = default;
-
-    bool operator==(BytesPayload& other) {
-        return (std::memcmp(value, other.value, sizeof(value)) == 0);
-    }
-    bool operator!=(BytesPayload& other) {
-        return !(operator==(other));
-    }
-};
 
 struct ycsb_t {
     static constexpr int id = 0;
@@ -30,7 +29,15 @@ struct ycsb_t {
         static constexpr int id = 0;
         uint64_t key;
     };
-    BytesPayload<YCSB_LEN> value;
+    u16 len; // bytes of value in use
+    u8 value[YCSB_MAX_LEN];
+
+    // only the used part of value is stored
+    static unsigned payloadSize(const ycsb_t& record) {
+        return offsetof(ycsb_t, value) + record.len;
+    }
+
+    std::span<const u8> used() const { return {value, len}; }
 
     template <class T>
     static unsigned foldKey(uint8_t* out, const T& record) {
@@ -48,6 +55,75 @@ struct ycsb_t {
 };
 
 
+struct YCSBOp {
+    enum Type : u8 {
+        Read,
+        Update,
+        Insert,
+        Scan,
+        ReadModifyWrite,
+        Count,
+    };
+    static constexpr const char* names[Count] = {"read", "update", "insert", "scan", "read-modify-write"};
+
+    Type type;
+    uint64_t key;
+    unsigned len = 0; // records of a scan, value size of an insert
+};
+
+
+// Latency histograms per operation type (fio buckets, ns), one per shard and
+// merged at the end
+struct YCSBLatencies {
+    latency::Histogram hist[YCSBOp::Count];
+    uint64_t count[YCSBOp::Count] = {};
+
+    YCSBLatencies() {
+        for (auto& h : hist) {
+            h.init();
+        }
+    }
+    ~YCSBLatencies() {
+        for (auto& h : hist) {
+            free(h.plat);
+        }
+    }
+    YCSBLatencies(const YCSBLatencies&) = delete;
+
+    void add(YCSBOp::Type type, uint64_t cycles) {
+        hist[type].add(cycles / 2.4); // RDTSCClock runs at 2.4 GHz
+        ++count[type];
+    }
+
+    void merge(const YCSBLatencies& other) {
+        for (unsigned t = 0; t < YCSBOp::Count; ++t) {
+            for (unsigned i = 0; i < latency::PLAT_NR; ++i) {
+                hist[t].plat[i] += other.hist[t].plat[i];
+            }
+            count[t] += other.count[t];
+        }
+    }
+
+    void print() {
+        for (unsigned t = 0; t < YCSBOp::Count; ++t) {
+            if (count[t] > 0) {
+                hist[t].show(count[t], 2, YCSBOp::names[t], count[t]);
+            }
+        }
+    }
+};
+
+
+// YCSB core workloads, --ycsb_workload:
+//   a: 50% read, 50% update        d: 95% read latest, 5% insert
+//   b: 95% read, 5% update         e: 95% scan, 5% insert
+//   c: 100% read                   f: 50% read, 50% read-modify-write
+// Without one, reads and updates are mixed by read_ratio as before.
+//
+// Keys are uniform, or Zipfian for theta > 0 with the ranks scrambled over
+// the key space like YCSB does, so the hot keys do not share a few leaves.
+// d counts its ranks back from the newest insert instead. Inserts append
+// keys after the loaded ones.
 template <template <typename> class AdapterType>
 struct YCSBWorkload {
 
@@ -55,31 +131,155 @@ struct YCSBWorkload {
 
     uint64_t tuple_count;
     int read_ratio;
+    unsigned multiget; // keys per read, more than one are looked up with one lookupBatch
+    std::string workload;
+    u8 mix[YCSBOp::Count] = {}; // percent of each operation type
+    bool latest = false;        // d: reads favour recent inserts
+    double theta;
+    unsigned scan_max;
+    unsigned value_min;
+    unsigned value_max;
+
+    zipf_distribution<> zipf;
+    std::atomic<uint64_t> next_key; // for inserts, shared by all shards
+
+    // Inserts finish out of order, the latest keys are counted from the first
+    // one still in flight, as YCSB's AcknowledgedCounterGenerator
+    struct Acknowledged {
+        static constexpr uint64_t kWindow = 1 << 16; // inserts in flight at most
+        std::atomic<uint64_t> limit;                 // keys below are all inserted
+        std::unique_ptr<std::atomic<bool>[]> done = std::make_unique<std::atomic<bool>[]>(kWindow);
+        std::mutex advancing;
+
+        explicit Acknowledged(uint64_t start) : limit(start) {}
+
+        void ack(uint64_t key) {
+            done[key % kWindow] = true;
+            while (true) {
+                std::unique_lock lock(advancing, std::try_to_lock);
+                if (!lock) {
+                    return; // the holder moves the limit
+                }
+                uint64_t l = limit.load(std::memory_order_relaxed);
+                while (done[l % kWindow]) {
+                    done[l % kWindow] = false;
+                    ++l;
+                }
+                limit.store(l, std::memory_order_release);
+                lock.unlock();
+                if (!done[l % kWindow]) {
+                    return; // nobody acked the next one while we held the lock
+                }
+            }
+        }
+    };
+    Acknowledged acknowledged;
+    static inline thread_local std::mt19937 zipf_rng{static_cast<std::mt19937::result_type>(RandomGenerator::getRandU64())};
 
 public:
     YCSBWorkload(AdapterType<ycsb_t>& t,
                  uint64_t tuple_count,
-                 int read_ratio = 100)
+                 int read_ratio = 100,
+                 unsigned multiget = 1,
+                 const std::string& workload = "",
+                 double theta = 0,
+                 unsigned scan_max = 100,
+                 unsigned value_min = YCSB_LEN,
+                 unsigned value_max = YCSB_LEN)
         : table(t),
           tuple_count(tuple_count),
-          read_ratio(read_ratio) {
+          read_ratio(read_ratio),
+          multiget(multiget),
+          workload(workload),
+          theta(theta),
+          scan_max(scan_max),
+          value_min(value_min),
+          value_max(value_max),
+          zipf(tuple_count, theta > 0 ? theta : 1.0),
+          next_key(tuple_count),
+          acknowledged(tuple_count) {
+        ensure(value_min <= value_max && value_max <= YCSB_MAX_LEN);
+        using enum YCSBOp::Type;
+        if (workload == "a") {
+            mix[Read] = 50;
+            mix[Update] = 50;
+        } else if (workload == "b") {
+            mix[Read] = 95;
+            mix[Update] = 5;
+        } else if (workload == "c") {
+            mix[Read] = 100;
+        } else if (workload == "d") {
+            mix[Read] = 95;
+            mix[Insert] = 5;
+            latest = true;
+        } else if (workload == "e") {
+            mix[Scan] = 95;
+            mix[Insert] = 5;
+        } else if (workload == "f") {
+            mix[Read] = 50;
+            mix[ReadModifyWrite] = 50;
+        } else {
+            ensure(workload.empty(), "unknown ycsb workload");
+        }
     }
 
 
     void loadTable() {
-        for (uint64_t i = 0; i < tuple_count; ++i) {
+        loadTable(0, tuple_count);
+    }
+
+    void loadTable(uint64_t begin, uint64_t end) {
+        for (uint64_t i = begin; i < end; ++i) {
             ycsb_t record;
-            RandomGenerator::getRandString(reinterpret_cast<u8*>(record.value.value), YCSB_LEN);
+            record.len = valueSize();
+            RandomGenerator::getRandString(record.value, record.len);
             table.insert({i}, record);
         }
 
-        Logger::info("loaded ", tuple_count, " tuples");
+        Logger::info("loaded ", end - begin, " tuples");
+    }
+
+
+    unsigned valueSize() {
+        return RandomGenerator::getRand(value_min, value_max + 1);
+    }
+
+    // FNV-1a over the bytes of the rank, as YCSB's ScrambledZipfianGenerator
+    static uint64_t scramble(uint64_t rank) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (unsigned i = 0; i < sizeof(rank); ++i) {
+            hash ^= rank & 0xff;
+            hash *= 0x100000001b3ull;
+            rank >>= 8;
+        }
+        return hash;
+    }
+
+    uint64_t chooseKey() {
+        uint64_t rank = theta > 0 ? zipf(zipf_rng) - 1 : RandomGenerator::getRand(uint64_t{0}, tuple_count);
+        if (latest) {
+            return acknowledged.limit.load(std::memory_order_acquire) - 1 - rank;
+        }
+        return theta > 0 ? scramble(rank) % tuple_count : rank;
     }
 
 
     void read(uint64_t key) {
-        table.lookup1({key}, [&](const ycsb_t& rec) {
-            do_not_optimize(rec);
+        table.lookup({key}, [&](const ycsb_t& rec) {
+            do_not_optimize(rec.used());
+        });
+    }
+
+
+    // key and multiget - 1 random others
+    void readBatch(uint64_t key) {
+        ycsb_t::Key keys[Config::kMaxMultiget]; // multiget is checked against it in Config
+        keys[0] = {key};
+        for (unsigned i = 1; i < multiget; ++i) {
+            keys[i] = {chooseKey()};
+        }
+        table.lookupBatch(std::span<const ycsb_t::Key>(keys, multiget), [&](unsigned, const ycsb_t& rec) {
+            do_not_optimize(rec.used());
         });
     }
 
@@ -88,22 +288,100 @@ public:
     uint64_t total = 0;
     std::array<uint64_t, 256> hist;
 
+    // values keep their size
     void write(uint64_t key) {
         table.update1({key}, [&](ycsb_t& rec) {
-            RandomGenerator::getRandString(reinterpret_cast<u8*>(rec.value.value), YCSB_LEN);
-            do_not_optimize(rec);
+            RandomGenerator::getRandString(rec.value, rec.len);
+            do_not_optimize(rec.used());
         });
     }
 
-    int tx() {
-        uint64_t key = RandomGenerator::getRand(uint64_t{0}, tuple_count);
+    void insert(uint64_t key, unsigned len) {
+        ycsb_t record;
+        record.len = len;
+        RandomGenerator::getRandString(record.value, len);
+        table.insert({key}, record);
+    }
+
+    void scan(uint64_t key, unsigned len) {
+        unsigned n = 0;
+        table.scan({key}, [&](const auto&, const ycsb_t& rec) {
+            do_not_optimize(rec.used());
+            return ++n < len;
+        });
+    }
+
+    // reads the old value under the exclusive latch
+    void readModifyWrite(uint64_t key) {
+        table.update1({key}, [&](ycsb_t& rec) {
+            do_not_optimize(rec.used());
+            for (unsigned i = 0; i < rec.len; ++i) {
+                rec.value[i] ^= 0x5a;
+            }
+        });
+    }
+
+
+    YCSBOp next() {
+        using enum YCSBOp::Type;
         u64 rnd = RandomGenerator::getRand(0, 100);
+        YCSBOp::Type type = Count;
+        if (workload.empty()) {
+            type = rnd <= static_cast<u64>(read_ratio) ? Read : Update;
+        } else {
+            for (unsigned t = 0, cumulative = 0; type == Count; ++t) {
+                cumulative += mix[t];
+                if (rnd < cumulative) {
+                    type = static_cast<YCSBOp::Type>(t);
+                }
+            }
+        }
+        switch (type) {
+            case Insert: {
+                uint64_t key = next_key.fetch_add(1, std::memory_order_relaxed);
+                ensure(!latest || key - acknowledged.limit.load(std::memory_order_relaxed) < Acknowledged::kWindow, "too many ycsb inserts in flight");
+                return {type, key, valueSize()};
+            }
+            case Scan:
+                return {type, chooseKey(), RandomGenerator::getRand(1u, scan_max + 1)};
+            default:
+                return {type, chooseKey()};
+        }
+    }
 
-        if (rnd <= read_ratio) {
-            read(key);
-            return 0;
+    // a restarted transaction is retried with the same operation
+    void run(const YCSBOp& op) {
+        switch (op.type) {
+            case YCSBOp::Read:
+                if (multiget > 1) {
+                    readBatch(op.key);
+                } else {
+                    read(op.key);
+                }
+                break;
+            case YCSBOp::Update:
+                write(op.key);
+                break;
+            case YCSBOp::Insert:
+                insert(op.key, op.len);
+                if (latest) {
+                    acknowledged.ack(op.key);
+                }
+                break;
+            case YCSBOp::Scan:
+                scan(op.key, op.len);
+                break;
+            case YCSBOp::ReadModifyWrite:
+                readModifyWrite(op.key);
+                break;
+            case YCSBOp::Count:
+                __builtin_unreachable();
         }
-        write(key);
-        return 1;
+    }
+
+    int tx() {
+        YCSBOp op = next();
+        run(op);
+        return op.type;
     }
 };
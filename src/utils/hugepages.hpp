@@ -35,6 +35,13 @@ struct HugePages {
         return reinterpret_cast<T*>(malloc(size));
     }
 
+    // numa_node < 0: no binding, the first touch decides
+    template <typename T>
+    static auto malloc_array_on_socket(size_t count, int numa_node) {
+        auto size = sizeof(T) * count;
+        return reinterpret_cast<T*>(numa_node < 0 ? malloc(size) : malloc_on_socket(size, numa_node));
+    }
+
     template <typename T>
     static auto free_array(T* ptr, size_t count) {
         auto size = sizeof(T) * count;
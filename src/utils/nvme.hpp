@@ -12,7 +12,7 @@
 extern uint32_t nsid;
 extern uint32_t lba_shift;
 
-int nvme_get_info(int fd) {
+inline int nvme_get_info(int fd) {
     nsid = ioctl(fd, NVME_IOCTL_ID);
     check_ret(nsid);
 
@@ -92,3 +92,15 @@ inline void prep_nvme_write(struct io_uring_sqe* sqe, int fd, void* buf, uint32_
     cmd->nsid = nsid;
     // cmd->cdw13 = 1 << 6; // DSM Sequential Request
 }
+
+inline void prep_nvme_flush(struct io_uring_sqe* sqe, int fd) {
+    sqe->fd = fd;
+    sqe->flags = 0;
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->cmd_op = NVME_URING_CMD_IO;
+    struct nvme_uring_cmd* cmd = reinterpret_cast<struct nvme_uring_cmd*>(sqe->cmd);
+    memset(cmd, 0, sizeof(struct nvme_uring_cmd));
+
+    cmd->opcode = nvme_cmd_flush;
+    cmd->nsid = nsid;
+}